@@ -0,0 +1,28 @@
+#ifndef LEDS_H_
+#define LEDS_H_
+
+#include <stdint.h>
+
+// -- LEDS frame buffer ---------------------------------------------------------------
+//
+// Each LED has a brightness level, shown with bit angle modulation: bit k of every level
+// is output for 2^k time units, k_led_bits planes per frame. The planes are kept as one
+// BSRR word per GPIO port, so the refresh timer interrupt writes a handful of registers
+// and never looks at a pin. Levels are set in the frame buffer and take effect with
+// leds_show(), from the main loop.
+
+enum { led0 = 0, led1, led2, led3, led4, led5, led6, led7, ledCount };
+
+#define k_led_bits 3
+#define k_led_max_level ((1 << k_led_bits) - 1)
+#define k_led_unit_us 200  // shortest plane, a frame takes 7 units (1.4 ms)
+
+// Set up the LED pins and start the refresh timer (TIM14), all LEDs off
+void leds_init();
+
+void leds_set(uint8_t led, uint8_t level);
+
+// Convert the frame buffer to BSRR words for the refresh timer
+void leds_show();
+
+#endif  // LEDS_H_
@@ -0,0 +1,30 @@
+#ifndef POTS_H_
+#define POTS_H_
+
+#include <stdint.h>
+
+// -- POTS continuous sampling --------------------------------------------------------
+//
+// The ADC converts every pot on each TIM15 trigger and DMA writes the samples to a
+// circular buffer. Each time half of it is full, the DMA interrupt sums the half
+// (oversampling and decimation) and runs the sum through a one pole IIR lowpass. Readers
+// only load the latest filtered value, no conversion ever runs or is waited for in
+// interrupt context.
+
+enum { pot_0 = 0, pot_count };
+
+#define k_pot_sample_hz 4000  // conversions of every pot per second
+#define k_pot_oversampling 16  // 12 bit samples summed per filtered value, 250 Hz
+#define k_pot_iir_shift 2      // IIR coefficient 1/4, about 16 ms time constant
+
+// Full scale of pot_value(): 16 samples of 12 bits sum to 16 bits
+#define k_pot_value_max 0xFFF0
+
+// Set up TIM15, the ADC and DMA and start sampling
+void pots_init();
+
+// Latest filtered value of a pot, 0 - k_pot_value_max. 0 until the first half buffer
+// has been converted.
+uint16_t pot_value(uint8_t pot);
+
+#endif  // POTS_H_
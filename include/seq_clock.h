@@ -0,0 +1,67 @@
+#ifndef SEQ_CLOCK_H_
+#define SEQ_CLOCK_H_
+
+#include <stdint.h>
+
+// -- SEQUENCER clock -----------------------------------------------------------------
+//
+// Sequencer time is a count of whole units (event timer ticks, or sequencer ticks when
+// polling) plus a remainder in 1/den of a unit. Every interrupt advances it by an exact
+// fraction, whole + num / den, which a tempo change works out once with one division.
+// The interrupt only adds and compares, and nothing is rounded while the tempo holds,
+// so the schedule cannot drift. A tempo change keeps the position and rescales the
+// remainder to the new denominator, rounded to nearest.
+
+#define k_seq_poll_hz 20000
+#define k_seq_timer_hz 31250  // event timer resolution, half a step at 4 BPM fits 16 bits
+
+typedef struct {
+    uint32_t whole;  // units per interrupt
+    uint16_t num;    // plus num / den of a unit, num < den
+    uint16_t den;
+} seq_clock_rate_t;
+
+typedef struct {
+    uint32_t count;  // whole units, the event timer compare in the low 16 bits
+    uint16_t rem;    // rem / den of a unit, rem < den
+} seq_clock_t;
+
+// Event timer ticks per event for a tempo in BPM x 10, an event is half a step
+// (60 s x 10 / 4 steps / 2 events)
+static constexpr seq_clock_rate_t seq_clock_event_rate(uint32_t tempo) {
+    return {(uint32_t)k_seq_timer_hz * 75 / tempo,
+            (uint16_t)((uint32_t)k_seq_timer_hz * 75 % tempo), (uint16_t)tempo};
+}
+
+// Sequencer ticks per poll for a tempo in BPM x 10, less than one: ticks per second are
+// tempo x 100 x 4 / 600
+static constexpr seq_clock_rate_t seq_clock_poll_rate(uint32_t tempo) {
+    return {0, (uint16_t)tempo, (uint16_t)(k_seq_poll_hz * 3 / 2)};
+}
+
+// Advance by one interrupt, true when the remainder carried a whole unit
+static inline bool seq_clock_advance(seq_clock_t* clock, const seq_clock_rate_t* rate) {
+    clock->count += rate->whole;
+    clock->rem += rate->num;
+    if (clock->rem >= rate->den) {
+        clock->rem -= rate->den;
+        ++clock->count;
+        return true;
+    }
+    return false;
+}
+
+// Switch to a new rate from the current position
+static inline void seq_clock_set_rate(seq_clock_t* clock, seq_clock_rate_t* rate,
+                                      const seq_clock_rate_t* new_rate) {
+    if (new_rate->den != rate->den) {
+        clock->rem = ((uint32_t)clock->rem * new_rate->den + rate->den / 2) / rate->den;
+        if (clock->rem >= new_rate->den) {
+            clock->rem -= new_rate->den;
+            ++clock->count;
+        }
+    }
+    *rate = *new_rate;
+}
+
+#endif  // SEQ_CLOCK_H_
@@ -0,0 +1,31 @@
+#ifndef SEQ_PITCH_H_
+#define SEQ_PITCH_H_
+
+#include <stdint.h>
+
+// -- SEQUENCER pitch -----------------------------------------------------------------
+//
+// Pitches use the braids::Quantizer format, a MIDI note number with a 7 bit fraction
+// (1/128 semitone). The scale is linear in semitones so conversion is a shift, no libm
+// or soft-float is needed in the sequencer interrupt.
+
+#define k_pitch_frac_bits 7
+#define k_pitch_root (60 << k_pitch_frac_bits)  // quantizer root, C4
+
+static constexpr int32_t note_to_pitch(uint8_t note) {
+    return (int32_t)(note & 0x7F) << k_pitch_frac_bits;
+}
+
+static constexpr uint8_t pitch_to_note(int32_t pitch) {
+    // round to nearest semitone and clamp to the 7 bit MIDI range
+    return (pitch < 0) ? 0
+           : (pitch >= (127 << k_pitch_frac_bits))
+               ? 127
+               : (uint8_t)((pitch + (1 << (k_pitch_frac_bits - 1))) >> k_pitch_frac_bits);
+}
+
+static_assert(pitch_to_note(note_to_pitch(0x42)) == 0x42, "pitch round trip");
+static_assert(pitch_to_note(note_to_pitch(127) + 63) == 127, "pitch clamps high");
+static_assert(pitch_to_note(-1) == 0, "pitch clamps low");
+
+#endif  // SEQ_PITCH_H_
@@ -0,0 +1,28 @@
+#ifndef SEQ_STORE_H_
+#define SEQ_STORE_H_
+
+#include <stdint.h>
+
+// -- SEQUENCER pattern store ---------------------------------------------------------
+//
+// Every pattern is kept in a flash region right below the NTS-1 unit catalog, the
+// patterns as they are in RAM after a small header. A save runs in the background from
+// loop(), a page erase or a chunk of programming per call through the NTS-1 flash calls,
+// which hold the main board off meanwhile. The header goes last, so an interrupted save
+// leaves no bank rather than a mix. Edits are ignored from the first chunk programmed
+// until the header is, so the bank holds the patterns as they were at that point.
+
+#define k_seq_store_chunk 64  // bytes programmed per seq_store_idle() call, even
+
+// Copy the stored bank into the patterns, false if there is none, it was stored with
+// another pattern layout or a pattern fails seq_engine_check_pattern(). The patterns keep
+// their defaults then. After seq_engine_init().
+bool seq_store_load();
+
+// Save every pattern, starting over if a save is running. Safe from interrupts.
+void seq_store_save();
+
+// Advance a save, from loop() after NTS1::idle()
+void seq_store_idle();
+
+#endif  // SEQ_STORE_H_
@@ -0,0 +1,105 @@
+#ifndef SEQUENCER_H_
+#define SEQUENCER_H_
+
+#include <stdint.h>
+
+// -- SEQUENCER track engine ----------------------------------------------------------
+
+#define k_seq_max_length 64
+#define k_seq_page_length 8  // one page per row of step buttons
+#define k_seq_num_pages (k_seq_max_length / k_seq_page_length)
+#define k_seq_num_tracks 4  // at most 8, each track is one bit of a per step mask
+#define k_seq_num_patterns 6
+#define k_seq_queue_length 8  // patterns waiting to be chained
+#define k_seq_max_locks 32      // parameter locks per pattern, shared by all steps
+#define k_seq_max_step_locks 4  // parameter locks on a single step
+
+// 7 bit step values packed back to back, plus one byte so the last value can be read
+// as a 16 bit word
+#define k_seq_value_bits 7
+#define k_seq_values_size ((k_seq_max_length * k_seq_value_bits + 7) / 8 + 1)
+
+// Per step track masks, 4 bits a step (two steps to a byte) while the tracks fit
+#define k_seq_mask_bits ((k_seq_num_tracks <= 4) ? 4 : 8)
+#define k_seq_masks_size (k_seq_max_length * k_seq_mask_bits / 8)
+
+enum { k_seq_track_kind_note = 0, k_seq_track_kind_param };
+
+// Parameter lock, a parameter value sent along with the step it is on. Packed in 3 bytes,
+// the step shares a byte with the top bits of the value.
+typedef struct {
+    uint8_t step_msb;  // step in bits 0 - 5, value bits 8 - 9 in bits 6 - 7
+    uint8_t param_id;  // k_param_id_*
+    uint8_t lsb;       // value bits 0 - 7
+} seq_lock_t;
+
+// Step data of a pattern. Gates, accents and ties are stored per step with one bit per
+// track so a step event loads a single mask covering every track. The struct holds only
+// bytes, no pointers and no padding, and is copied to and from flash as is.
+// Parameter locks are sparse: a bit per step tells whether the step has any, the locks
+// themselves live in a pool sorted by step so a step's locks are contiguous.
+typedef struct {
+    uint8_t length;                                       // 1 - 64 steps
+    uint8_t gates[k_seq_masks_size];                      // 1 bit per track
+    uint8_t accents[k_seq_masks_size];                    // 1 bit per track
+    uint8_t ties[k_seq_masks_size];                       // 1 bit per track
+    uint8_t values[k_seq_num_tracks][k_seq_values_size];  // 7 bit note or param value
+    uint8_t locked[k_seq_max_length / 8];                 // 1 bit per step
+    uint8_t num_locks;
+    seq_lock_t locks[k_seq_max_locks];  // sorted by step
+} seq_pattern_t;
+
+// Track state is laid out as struct-of-arrays. A step event only touches the tracks
+// that fire, so the interrupt cost follows the number of events rather than the number
+// of tracks.
+typedef struct {
+    uint8_t kind[k_seq_num_tracks];      // k_seq_track_kind_*
+    uint8_t param_id[k_seq_num_tracks];  // k_param_id_* driven by param tracks
+    uint8_t notes[k_seq_num_tracks];     // note in flight per track
+    uint8_t notes_on;                    // 1 bit per track with a note in flight
+    uint8_t pattern;                     // playing (and edited) pattern
+    uint8_t step;                        // play position, 0xFF before first step
+    uint8_t queue[k_seq_queue_length];   // patterns to play next, in order
+    uint8_t queue_ridx;
+    uint8_t queue_widx;
+} seq_tracks_t;
+
+extern seq_tracks_t g_seq_tracks;
+extern seq_pattern_t g_seq_patterns[k_seq_num_patterns];
+
+void seq_engine_init();
+
+// Send note off for every note in flight and move back to before the first step of
+// the playing pattern
+void seq_engine_rewind();
+
+// Advance the play position, chaining to the next queued pattern at the end of the
+// pattern, and send note on / parameter changes for every track gated on the new step
+// along with the step's parameter locks, all in one frame. Parameter values equal to the
+// main board's current one (NTS1::getParamValue) are skipped. Returns the new play
+// position.
+uint8_t seq_engine_next_step();
+
+// Send note off for every note in flight, except for notes tied into the next step
+void seq_engine_gate_off();
+
+// Whether pattern data keeps the invariants the engine relies on (length, sorted locks
+// and their counts, lock steps and flags), for patterns read back from flash
+bool seq_engine_check_pattern(const seq_pattern_t* pattern);
+
+// Ignore edits while held, so pattern data stays consistent while it is saved. Edits run
+// in the UI interrupt, one that has started always completes first.
+void seq_engine_hold_edits(bool hold);
+
+// Editing, steps are a mask of the 8 steps of a page of the playing pattern
+uint32_t seq_engine_page_gates(uint8_t track, uint8_t page);
+uint32_t seq_engine_page_accents(uint8_t track, uint8_t page);
+void seq_engine_toggle_gates(uint8_t track, uint8_t page, uint32_t steps);
+void seq_engine_cycle_articulation(uint8_t track, uint8_t page, uint32_t steps);
+void seq_engine_set_values(uint8_t track, uint8_t page, uint32_t steps, uint8_t value);
+void seq_engine_set_length(uint8_t length);
+void seq_engine_queue_pattern(uint8_t pattern);
+void seq_engine_set_locks(uint8_t page, uint32_t steps, uint8_t param_id, uint16_t value);
+void seq_engine_clear_locks(uint8_t page, uint32_t steps);
+
+#endif  // SEQUENCER_H_
@@ -41,6 +41,62 @@ static nts1_edit_param_desc_event_handler sEditParamDescEventHandler = nullptr;
 static nts1_value_event_handler sValueEventHandler = nullptr;
 static nts1_param_change_handler sParamChangeHandler = nullptr;
 
+// Last value sent or received per parameter, one slot per main ID and one per sub-ID of
+// the parameters that have them. Slots are 16 bit so writers in interrupts and in
+// loop() never tear a value.
+enum {
+  kShadowOscEdit   = k_param_id_sys_global, // sub-IDs of k_param_id_osc_edit
+  kShadowSysGlobal = kShadowOscEdit + k_num_osc_param_subid,
+  kShadowSize      = kShadowSysGlobal + k_num_sys_global_param_subid,
+};
+
+static volatile uint16_t sParamShadow[kShadowSize];
+
+// Local writes not confirmed yet per slot: changes queued whose echo has not come back,
+// plus a flag while a change waits in the interface's stage. The main board echoes
+// changes in the order they went out, so a value received while the slot has local
+// writes out is older than the last one written and is not recorded. Only touched under
+// the tx lock, changes are queued from interrupts too.
+enum {
+  kShadowStaged     = 0x80,
+  kShadowEchoesMask = 0x7F,
+};
+
+static volatile uint8_t sParamInFlight[kShadowSize];
+
+static uint8_t shadowSlot(uint8_t id, uint8_t subid) {
+  if (id == k_param_id_osc_edit)
+    return (subid < k_num_osc_param_subid) ? kShadowOscEdit + subid : kShadowSize;
+  if (id == k_param_id_sys_global)
+    return (subid < k_num_sys_global_param_subid) ? kShadowSysGlobal + subid : kShadowSize;
+  return (id < k_param_id_sys_global) ? id : (uint8_t)kShadowSize;
+}
+
+// Value received from the main board, either the echo of a change sent or a change made
+// on the main board itself
+static void shadowReceive(uint8_t id, uint8_t subid, uint16_t value) {
+  const uint8_t slot = shadowSlot(id, subid);
+  if (slot >= kShadowSize)
+    return;
+  const uint32_t primask = nts1_tx_lock();
+  uint8_t in_flight = sParamInFlight[slot];
+  if (in_flight & kShadowEchoesMask)
+    sParamInFlight[slot] = --in_flight;
+  if (!in_flight)
+    sParamShadow[slot] = value;
+  nts1_tx_unlock(primask);
+}
+
+// Called by the interface with the tx lock held for every parameter change it queues,
+// staged or sent directly
+extern "C" void nts1_param_change_queued(const nts1_tx_param_change_t *param_change) {
+  const uint8_t slot = shadowSlot(param_change->param_id, param_change->param_subid);
+  if (slot >= kShadowSize)
+    return;
+  // the stage holds the last change only, once queued nothing newer waits there
+  const uint8_t echoes = sParamInFlight[slot] & kShadowEchoesMask;
+  sParamInFlight[slot] = (echoes < kShadowEchoesMask) ? echoes + 1 : echoes;
+}
 
 NTS1::NTS1(void)
 {
@@ -52,6 +108,68 @@ NTS1::~NTS1(void) {
     sNts1Instance = nullptr;
 }
 
+uint8_t NTS1::paramChange(uint8_t id, uint8_t subid, uint16_t value) {
+  // only 14 bits go out
+  value &= 0x3FFF;
+  const uint8_t slot = shadowSlot(id, subid);
+  // compared and recorded along with staging, a frame queued from an interrupt in
+  // between would otherwise be overwritten in the table
+  const uint32_t primask = nts1_tx_lock();
+  uint8_t status = STATUS_OK;
+  if (slot >= kShadowSize || sParamShadow[slot] != value) {
+    status = nts1_param_change(id, subid, value);
+    if (status == STATUS_OK && slot < kShadowSize) {
+      sParamShadow[slot] = value;
+      // still staged if the tx buffer is backed up, cleared again once it goes out
+      if (nts1_param_staged(id, subid))
+        sParamInFlight[slot] |= kShadowStaged;
+    }
+  }
+  nts1_tx_unlock(primask);
+  return status;
+}
+
+uint8_t NTS1::sendFrame(const nts1_tx_param_change_t *param_changes, uint8_t param_count,
+                        const nts1_tx_event_t *events, uint8_t event_count) {
+  const uint32_t primask = nts1_tx_lock();
+  const uint8_t status = nts1_send_frame(param_changes, param_count, events, event_count);
+  if (status == STATUS_OK) {
+    for (uint8_t i = 0; i < param_count; ++i) {
+      const nts1_tx_param_change_t *param = &param_changes[i];
+      const uint8_t slot = shadowSlot(param->param_id, param->param_subid);
+      if (slot < kShadowSize)
+        sParamShadow[slot] = ((param->msb & 0x7F) << 7) | (param->lsb & 0x7F);
+    }
+  }
+  nts1_tx_unlock(primask);
+  return status;
+}
+
+uint16_t NTS1::getParamValue(uint8_t id, uint8_t subid) {
+  const uint8_t slot = shadowSlot(id, subid);
+  return (slot < kShadowSize) ? sParamShadow[slot] : (uint16_t)PARAM_VALUE_UNKNOWN;
+}
+
+void NTS1::invalidateParamValues(void) {
+  const uint32_t primask = nts1_tx_lock();
+  for (uint8_t i = 0; i < kShadowSize; ++i)
+    sParamShadow[i] = PARAM_VALUE_UNKNOWN;
+  for (uint8_t i = 0; i < kShadowSize; ++i)
+    sParamInFlight[i] = 0;
+  nts1_tx_unlock(primask);
+}
+
+void NTS1::recordParamChange(const nts1_rx_param_change_t *param_change) {
+  shadowReceive(param_change->param_id, param_change->param_subid,
+                ((param_change->msb & 0x7F) << 7) | (param_change->lsb & 0x7F));
+}
+
+void NTS1::recordValue(const nts1_rx_value_t *value) {
+  // unit counts come back as value events too
+  if (value->req_id == k_nts1_tx_event_id_req_value)
+    shadowReceive(value->main_id, value->sub_id, value->value);
+}
+
 void NTS1::setNoteOffEventHandler(nts1_note_off_event_handler handler) {
   sNoteOffEventHandler = handler;
 }
@@ -117,6 +235,7 @@ void nts1_handle_edit_param_desc_event(const nts1_rx_edit_param_desc_t *param_de
 
 extern "C" __attribute__((weak))
 void nts1_handle_value_event(const nts1_rx_value_t *value) {
+  NTS1::recordValue(value);
   if (sValueEventHandler != nullptr) {
     sValueEventHandler(value);
   }
@@ -124,6 +243,7 @@ void nts1_handle_value_event(const nts1_rx_value_t *value) {
 
 extern "C" __attribute__((weak))
 void nts1_handle_param_change(const nts1_rx_param_change_t *param_change) {
+  NTS1::recordParamChange(param_change);
   if (sParamChangeHandler != nullptr) {
     sParamChangeHandler(param_change);
   }
@@ -33,6 +33,8 @@
 #define _NTS1_H_
 
 #include "nts1_iface.h"
+#include "nts1_catalog.h"
+#include "nts1_flash.h"
 
 class NTS1 {
  public:
@@ -85,6 +87,13 @@ class NTS1 {
         RX_EVENT_ID_VALUE           = 0x13U,
   };
 
+  /**
+   * TX lanes, realtime traffic is always sent ahead of bulk traffic
+   */  
+  enum {
+        LANE_REALTIME = 0x00U,
+        LANE_BULK     = 0x01U,
+  };
   /**
    * Parameter IDs
    */  
@@ -221,6 +230,21 @@ class NTS1 {
         INVALID_PARAM_SUBID = 0xFU,
   };
 
+  /**
+   * Unit types of the catalog
+   */  
+  enum {
+        UNIT_TYPE_OSC = 0U,
+        UNIT_TYPE_FILTER,
+        UNIT_TYPE_AMPEG,
+        UNIT_TYPE_MOD,
+        UNIT_TYPE_DELAY,
+        UNIT_TYPE_REVERB,
+        UNIT_TYPE_ARP_PATTERN,
+        UNIT_TYPE_ARP_INTERVALS,
+        NUM_UNIT_TYPES,
+  };
+
   /**
    * Types for edit parameters
    */  
@@ -233,9 +257,21 @@ class NTS1 {
   // ----------------------------------------------------------
 
   /**
-   * Initialize main board interface
+   * Value returned for parameters not sent or received yet
+   */  
+  enum {
+        PARAM_VALUE_UNKNOWN = 0xFFFFU,
+  };
+
+  // ----------------------------------------------------------
+
+  /**
+   * Initialize main board interface, forgets all parameter values
    */  
-  static inline uint8_t init() { return nts1_init(); }
+  static inline uint8_t init() {
+    invalidateParamValues();
+    return nts1_init();
+  }
 
   /**
    * Tear down main board interface
@@ -244,16 +280,45 @@ class NTS1 {
 
   /**
    * Process tx/rx communications with main board
-   * Must be called regularly from the loop() function. 
+   * Must be called regularly from the loop() function. STATUS_BUSY when called from an
+   * event handler, received data is not processed then.
    */  
   static inline uint8_t idle() { return nts1_idle(); }
 
   /**
    * Send a parameter change message to the NTS-1 main board
+   * Nothing is sent if the value equals the last one sent or received for the parameter.
    */  
-  static inline uint8_t paramChange(uint8_t id, uint8_t subid, uint16_t value) {
-    return nts1_param_change(id, subid, value);
-  }
+  static uint8_t paramChange(uint8_t id, uint8_t subid, uint16_t value);
+
+  /**
+   * Send parameter changes and events to the NTS-1 main board as one frame
+   * Sent as given, parameter values are recorded once the frame is queued.
+   */  
+  static uint8_t sendFrame(const nts1_tx_param_change_t *param_changes, uint8_t param_count,
+                           const nts1_tx_event_t *events, uint8_t event_count);
+
+  /**
+   * Get the last value sent or received for a parameter, PARAM_VALUE_UNKNOWN if none
+   * Sub-IDs only matter for PARAM_ID_OSC_EDIT and PARAM_ID_SYS_GLOBAL.
+   * Received values are recorded by the default parameter change and value event
+   * handlers, changes sent with the C API directly are not. Values received before the
+   * echoes of the changes sent are back are older and not recorded.
+   */  
+  static uint16_t getParamValue(uint8_t id, uint8_t subid);
+
+  /**
+   * Forget all parameter values, the next change of each parameter is always sent
+   */  
+  static void invalidateParamValues(void);
+
+  /**
+   * Record a received parameter value for getParamValue()
+   * Done by the default event handlers and by NTS1Dispatch, only needed by handlers that
+   * replace nts1_handle_param_change() / nts1_handle_value_event() otherwise.
+   */  
+  static void recordParamChange(const nts1_rx_param_change_t *param_change);
+  static void recordValue(const nts1_rx_value_t *value);
 
   /**
    * Send a note on event to the NTS-1 main board
@@ -269,6 +334,55 @@ class NTS1 {
     return nts1_note_off(note);
   }
   
+  /**
+   * Get queuing statistics of a tx lane (LANE_REALTIME, LANE_BULK)
+   */  
+  static inline void getTxLaneStats(uint8_t lane, nts1_tx_lane_stats_t *stats) {
+    nts1_get_tx_lane_stats(lane, stats);
+  }
+  /**
+   * Reset queuing statistics of all tx lanes
+   */  
+  static inline void resetTxLaneStats(void) {
+    nts1_reset_tx_lane_stats();
+  }
+  /**
+   * Set the unread rx byte counts at which the main board is held off and let go again
+   */  
+  static inline uint8_t setRxAckWatermarks(uint16_t high, uint16_t low) {
+    return nts1_set_rx_ack_watermarks(high, low);
+  }
+  /**
+   * Set the rx bytes and microseconds of parsing after which idle() leaves the rest for
+   * the next call, 0 for no limit
+   */  
+  static inline uint8_t setIdleBudget(uint16_t max_bytes, uint16_t max_us) {
+    return nts1_set_idle_budget(max_bytes, max_us);
+  }
+  /**
+   * Get rx parsing statistics of idle() (time and bytes per call, backlog, budget stops)
+   */  
+  static inline void getIdleStats(nts1_idle_stats_t *stats) {
+    nts1_get_idle_stats(stats);
+  }
+  /**
+   * Reset rx parsing statistics of idle(), the budget is kept
+   */  
+  static inline void resetIdleStats(void) {
+    nts1_reset_idle_stats();
+  }
+  /**
+   * Get transport statistics of the SPI link (throughput, drops, ACK stalls)
+   */  
+  static inline void getLinkStats(nts1_link_stats_t *stats) {
+    nts1_get_link_stats(stats);
+  }
+  /**
+   * Reset transport statistics of the SPI link
+   */  
+  static inline void resetLinkStats(void) {
+    nts1_reset_link_stats();
+  }
   /**
    * Request system version from the NTS-1 main board
    */  
@@ -401,7 +515,121 @@ class NTS1 {
   static inline uint8_t reqArpIntervalsDesc(uint8_t idx) {
     return nts1_req_arp_intervals_desc(idx);
   }
+
+  /**
+   * Send a request (TX_EVENT_ID_REQ_*) to the NTS-1 main board and have handler called
+   * from idle() with the matching reply, or with STATUS_TIMEOUT once timeout_us has passed
+   * STATUS_BUSY while too many requests are outstanding, see NTS1_MAX_PENDING_REQUESTS.
+   */  
+  static inline uint8_t request(uint8_t event_id, uint8_t main_id, uint8_t sub_id,
+                                uint32_t timeout_us, nts1_reply_handler handler,
+                                void *context = nullptr) {
+    return nts1_request(event_id, main_id, sub_id, timeout_us, handler, context);
+  }
+
+  /**
+   * Request value of given parameter, reply to handler
+   */  
+  static inline uint8_t reqParamValue(uint8_t id, uint8_t subid, uint32_t timeout_us,
+                                      nts1_reply_handler handler, void *context = nullptr) {
+    return nts1_request(TX_EVENT_ID_REQ_VALUE, id, subid, timeout_us, handler, context);
+  }
+
+  /**
+   * Request number of units of a type (PARAM_ID_*_TYPE, PARAM_ID_ARP_PATTERN,
+   * PARAM_ID_ARP_INTERVALS), reply to handler
+   */  
+  static inline uint8_t reqUnitCount(uint8_t unit_id, uint32_t timeout_us,
+                                     nts1_reply_handler handler, void *context = nullptr) {
+    return nts1_request(TX_EVENT_ID_REQ_UNIT_COUNT, unit_id, 0, timeout_us, handler, context);
+  }
+
+  /**
+   * Request descriptor of a unit of a type, reply to handler
+   */  
+  static inline uint8_t reqUnitDesc(uint8_t unit_id, uint8_t idx, uint32_t timeout_us,
+                                    nts1_reply_handler handler, void *context = nullptr) {
+    return nts1_request(TX_EVENT_ID_REQ_UNIT_DESC, unit_id, idx, timeout_us, handler, context);
+  }
+
+  /**
+   * Request oscillator edit parameter descriptor, reply to handler
+   */  
+  static inline uint8_t reqOscEditParamDesc(uint8_t idx, uint32_t timeout_us,
+                                            nts1_reply_handler handler,
+                                            void *context = nullptr) {
+    return nts1_request(TX_EVENT_ID_REQ_PARAM_DESC, PARAM_ID_OSC_TYPE, idx, timeout_us,
+                        handler, context);
+  }
+
+  /**
+   * Get number of requests waiting for their reply
+   */  
+  static inline uint8_t getPendingRequestCount(void) {
+    return nts1_pending_request_count();
+  }
   
+  /**
+   * Load the unit catalog stored in flash, if any, and start checking it against the
+   * NTS-1 main board. Call after init().
+   */  
+  static inline void catalogInit(void) { nts1_catalog_init(); }
+
+  /**
+   * Read the unit catalog from the NTS-1 main board in the background
+   * Call from the loop() function after idle().
+   */  
+  static inline void catalogIdle(void) { nts1_catalog_idle(); }
+
+  /**
+   * Whether the whole unit catalog is known
+   */  
+  static inline uint8_t isCatalogReady(void) { return nts1_catalog_ready(); }
+
+  /**
+   * Get number of units of a type (UNIT_TYPE_*) from the catalog
+   */  
+  static inline uint8_t getUnitCount(uint8_t type) { return nts1_catalog_unit_count(type); }
+
+  /**
+   * Get name of a unit from the catalog, nullptr until it is known
+   */  
+  static inline const char *getUnitName(uint8_t type, uint8_t idx) {
+    return nts1_catalog_unit_name(type, idx);
+  }
+
+  /**
+   * Get number of edit parameters of a unit from the catalog
+   */  
+  static inline uint8_t getUnitParamCount(uint8_t type, uint8_t idx) {
+    return nts1_catalog_unit_param_count(type, idx);
+  }
+
+  /**
+   * Hold the NTS-1 main board off and unlock flash, true once it can be programmed.
+   * Until then call again from the next loop(). For the main loop only.
+   */  
+  static inline uint8_t flashBegin(void) { return nts1_flash_begin(); }
+
+  /**
+   * Lock flash and let the NTS-1 main board go
+   */  
+  static inline void flashEnd(void) { nts1_flash_end(); }
+
+  /**
+   * Program erased flash between flashBegin() and flashEnd(), size even
+   */  
+  static inline uint8_t flashProgram(uintptr_t address, const void *data, uint16_t size) {
+    return nts1_flash_program(address, data, size);
+  }
+
+  /**
+   * Erase whole pages of flash between flashBegin() and flashEnd()
+   */  
+  static inline uint8_t flashErase(uintptr_t address, uint16_t pages) {
+    return nts1_flash_erase(address, pages);
+  }
+
   /**
    * Register a handler function for received note off events
    */  
@@ -439,5 +667,86 @@ class NTS1 {
   
 };
 
+// ----------------------------------------------------------
+
+/**
+ * Handler set for NTS1Dispatch that ignores every event
+ * Derive from it and declare static functions of the same name and signature for the
+ * events of interest, the others are inlined away.
+ */
+struct NTS1Handlers {
+  static inline void onNoteOffEvent(const nts1_rx_note_off_t *) {}
+  static inline void onNoteOnEvent(const nts1_rx_note_on_t *) {}
+  static inline void onStepTickEvent(void) {}
+  static inline void onUnitDescEvent(const nts1_rx_unit_desc_t *) {}
+  static inline void onEditParamDescEvent(const nts1_rx_edit_param_desc_t *) {}
+  static inline void onValueEvent(const nts1_rx_value_t *) {}
+  static inline void onParamChange(const nts1_rx_param_change_t *) {}
+};
+
+/**
+ * NTS1 with its event handlers fixed at compile time
+ *
+ * NTS1_DISPATCH_HANDLERS(Handlers, name), in exactly one source file, defines the
+ * instance `name` along with the nts1_handle_* functions called by the interface to go
+ * straight to Handlers::on*(), which the compiler can inline. Defining both in one place
+ * keeps the handlers of the instance and of the interface the same. They replace the
+ * weak defaults, so handlers registered with the set*Handler() functions are not called
+ * anymore. Received parameter values are still recorded for getParamValue(). Other files
+ * reach the instance with `extern NTS1Dispatch<Handlers> name;`.
+ */
+template <class Handlers>
+class NTS1Dispatch : public NTS1 {
+ public:
+  static inline void dispatchNoteOffEvent(const nts1_rx_note_off_t *note_off) {
+    Handlers::onNoteOffEvent(note_off);
+  }
+  static inline void dispatchNoteOnEvent(const nts1_rx_note_on_t *note_on) {
+    Handlers::onNoteOnEvent(note_on);
+  }
+  static inline void dispatchStepTickEvent(void) {
+    Handlers::onStepTickEvent();
+  }
+  static inline void dispatchUnitDescEvent(const nts1_rx_unit_desc_t *unit_desc) {
+    Handlers::onUnitDescEvent(unit_desc);
+  }
+  static inline void dispatchEditParamDescEvent(const nts1_rx_edit_param_desc_t *param_desc) {
+    Handlers::onEditParamDescEvent(param_desc);
+  }
+  static inline void dispatchValueEvent(const nts1_rx_value_t *value) {
+    recordValue(value);
+    Handlers::onValueEvent(value);
+  }
+  static inline void dispatchParamChange(const nts1_rx_param_change_t *param_change) {
+    recordParamChange(param_change);
+    Handlers::onParamChange(param_change);
+  }
+};
+
+#define NTS1_DISPATCH_HANDLERS(Handlers, name)                                            \
+  NTS1Dispatch<Handlers> name;                                                            \
+  extern "C" void nts1_handle_note_off_event(const nts1_rx_note_off_t *note_off) {        \
+    NTS1Dispatch<Handlers>::dispatchNoteOffEvent(note_off);                               \
+  }                                                                                       \
+  extern "C" void nts1_handle_note_on_event(const nts1_rx_note_on_t *note_on) {           \
+    NTS1Dispatch<Handlers>::dispatchNoteOnEvent(note_on);                                 \
+  }                                                                                       \
+  extern "C" void nts1_handle_step_tick_event(void) {                                     \
+    NTS1Dispatch<Handlers>::dispatchStepTickEvent();                                      \
+  }                                                                                       \
+  extern "C" void nts1_handle_unit_desc_event(const nts1_rx_unit_desc_t *unit_desc) {     \
+    NTS1Dispatch<Handlers>::dispatchUnitDescEvent(unit_desc);                             \
+  }                                                                                       \
+  extern "C" void nts1_handle_edit_param_desc_event(                                      \
+      const nts1_rx_edit_param_desc_t *param_desc) {                                      \
+    NTS1Dispatch<Handlers>::dispatchEditParamDescEvent(param_desc);                       \
+  }                                                                                       \
+  extern "C" void nts1_handle_value_event(const nts1_rx_value_t *value) {                 \
+    NTS1Dispatch<Handlers>::dispatchValueEvent(value);                                    \
+  }                                                                                       \
+  extern "C" void nts1_handle_param_change(const nts1_rx_param_change_t *param_change) {  \
+    NTS1Dispatch<Handlers>::dispatchParamChange(param_change);                            \
+  }
+
 #endif // _NTS1_H_
   
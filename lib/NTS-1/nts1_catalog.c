@@ -0,0 +1,344 @@
+/**
+ * @file nts1_catalog.c
+ * @brief Unit descriptor catalog of the NTS-1 main board, kept in internal flash.
+ */
+
+#include "nts1_catalog.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "nts1_flash.h"
+#include "nts1_iface.h"
+#include "stm32_def.h"
+#include "stm32f0xx_hal.h"
+
+// Layout: header, one 16 bit entry per unit, string pool
+#define CATALOG_MAGIC (0x4E544331UL)  // "NTC1"
+#define CATALOG_MAX_UNITS (128)
+#define CATALOG_ENTRIES_OFFSET (16)
+#define CATALOG_POOL_OFFSET (CATALOG_ENTRIES_OFFSET + 2 * CATALOG_MAX_UNITS)
+#define CATALOG_POOL_SIZE (NTS1_CATALOG_FLASH_SIZE - CATALOG_POOL_OFFSET)
+
+// Entry: pool offset of the name (11 bits) and parameter count (5 bits, at most 30 so an
+// entry never reads as erased)
+#define CATALOG_ENTRY_EMPTY (0xFFFFU)
+#define CATALOG_ENTRY(offset, params) ((uint16_t)((offset) | ((params) << 11)))
+#define CATALOG_ENTRY_OFFSET(entry) ((entry) & 0x7FF)
+#define CATALOG_ENTRY_PARAMS(entry) ((entry) >> 11)
+#define CATALOG_MAX_PARAMS (30)
+
+// Descriptor requests in flight plus replies waiting to be programmed
+#define CATALOG_WINDOW (4)
+#define CATALOG_TIMEOUT_US (100000)
+
+#ifndef true
+#define true 1
+#endif
+
+#ifndef false
+#define false 0
+#endif
+
+typedef char s_catalog_pool_size_check[(CATALOG_POOL_SIZE > 0 && CATALOG_POOL_SIZE <= 0x800)
+                                           ? 1
+                                           : -1];
+
+// ----------------------------------------------------
+
+typedef struct {
+    uint16_t version;    // main board version the catalog was read from
+    uint16_t pool_size;  // bytes
+    uint8_t counts[k_nts1_num_unit_types];
+    uint32_t magic;  // programmed last, the catalog is valid once it reads back
+} s_catalog_header_t;
+
+typedef char s_catalog_header_size_check[(sizeof(s_catalog_header_t) <= CATALOG_ENTRIES_OFFSET)
+                                             ? 1
+                                             : -1];
+
+#define CATALOG_HEADER ((const s_catalog_header_t*)NTS1_CATALOG_FLASH_ADDR)
+#define CATALOG_ENTRIES ((const uint16_t*)(NTS1_CATALOG_FLASH_ADDR + CATALOG_ENTRIES_OFFSET))
+#define CATALOG_POOL ((const char*)(NTS1_CATALOG_FLASH_ADDR + CATALOG_POOL_OFFSET))
+
+enum {
+    k_catalog_state_version = 0U,  // waiting for the main board version
+    k_catalog_state_erase,         // stored catalog is stale
+    k_catalog_state_count,         // unit count of s_type
+    k_catalog_state_descs,         // unit descriptors of s_type
+    k_catalog_state_commit,        // header left to program
+    k_catalog_state_done,
+};
+
+// Descriptor received, waiting to be programmed
+typedef struct {
+    uint8_t type;
+    uint8_t idx;
+    uint8_t param_count;
+    char name[sizeof(((nts1_rx_unit_desc_t*)0)->name)];
+} s_catalog_desc_t;
+
+static const uint8_t s_unit_ids[k_nts1_num_unit_types] = {
+    k_param_id_osc_type, k_param_id_filt_type, k_param_id_ampeg_type,
+    k_param_id_mod_type, k_param_id_del_type,  k_param_id_rev_type,
+    k_param_id_arp_pattern, k_param_id_arp_intervals,
+};
+
+static uint8_t s_state;
+static uint8_t s_ready;
+static uint16_t s_version;
+static uint8_t s_counts[k_nts1_num_unit_types];  // stored, or read so far
+static uint16_t s_pool_size;
+
+static uint8_t s_type;      // being read
+static uint8_t s_next;      // next descriptor to request
+static uint8_t s_received;  // descriptors programmed
+static uint8_t s_in_flight;
+
+static s_catalog_desc_t s_queue[CATALOG_WINDOW];
+static uint8_t s_queued;
+
+// ----------------------------------------------------
+
+static uint8_t s_catalog_base(uint8_t type) {
+    uint8_t base = 0;
+    for (uint8_t t = 0; t < type; ++t) {
+        base += s_counts[t];
+    }
+    return base;
+}
+
+// size even, the region is programmed a half word at a time
+static inline uint8_t s_flash_program(uint16_t offset, const void* data, uint16_t size) {
+    return nts1_flash_program(NTS1_CATALOG_FLASH_ADDR + offset, data, size);
+}
+
+static inline uint8_t s_flash_erase(void) {
+    return nts1_flash_erase(NTS1_CATALOG_FLASH_ADDR, NTS1_CATALOG_FLASH_SIZE / FLASH_PAGE_SIZE);
+}
+
+// Names are stored NUL terminated and padded to a half word
+static inline uint16_t s_pool_stored_size(uint16_t len) { return (len + 2) & ~1U; }
+
+// Pool offset of name, added if not there yet. The empty name programmed at offset 0
+// along with the erase stands in once the pool is full.
+static uint16_t s_pool_intern(const char* name, uint16_t len) {
+    for (uint16_t offset = 0; offset < s_pool_size;) {
+        const char* stored = &CATALOG_POOL[offset];
+        const uint16_t stored_len = strlen(stored);
+        if (stored_len == len && memcmp(stored, name, len) == 0) {
+            return offset;
+        }
+        offset += s_pool_stored_size(stored_len);
+    }
+    const uint16_t size = s_pool_stored_size(len);
+    if (s_pool_size + size > CATALOG_POOL_SIZE) {
+        return 0;
+    }
+    char padded[sizeof(((s_catalog_desc_t*)0)->name) + 2] = {0};
+    memcpy(padded, name, len);
+    if (!s_flash_program(CATALOG_POOL_OFFSET + s_pool_size, padded, size)) {
+        return 0;
+    }
+    const uint16_t offset = s_pool_size;
+    s_pool_size += size;
+    return offset;
+}
+
+static void s_program_desc(const s_catalog_desc_t* desc) {
+    if (desc->type != s_type || desc->idx >= s_counts[s_type]) {
+        return;
+    }
+    const uint8_t slot = s_catalog_base(s_type) + desc->idx;
+    if (CATALOG_ENTRIES[slot] != CATALOG_ENTRY_EMPTY) {
+        return;  // late reply to a request sent again
+    }
+    uint16_t len = 0;
+    while (len < sizeof(desc->name) && desc->name[len]) {
+        ++len;
+    }
+    const uint16_t offset = s_pool_intern(desc->name, len);
+    const uint8_t params =
+        (desc->param_count < CATALOG_MAX_PARAMS) ? desc->param_count : CATALOG_MAX_PARAMS;
+    const uint16_t entry = CATALOG_ENTRY(offset, params);
+    if (s_flash_program(CATALOG_ENTRIES_OFFSET + 2 * slot, &entry, sizeof(entry))) {
+        ++s_received;
+    }
+}
+
+// ----------------------------------------------------
+
+static void s_on_version(nts1_status_t status, const nts1_rx_reply_t* reply, void* context) {
+    (void)context;
+    s_in_flight = 0;
+    if (status != k_nts1_status_ok || s_state != k_catalog_state_version) {
+        return;  // asked again from nts1_catalog_idle()
+    }
+    s_version = reply->value.value;
+    if (s_ready && CATALOG_HEADER->version == s_version) {
+        s_state = k_catalog_state_done;
+    } else {
+        s_ready = false;
+        s_state = k_catalog_state_erase;
+    }
+}
+
+static void s_on_count(nts1_status_t status, const nts1_rx_reply_t* reply, void* context) {
+    (void)context;
+    s_in_flight = 0;
+    if (status != k_nts1_status_ok || s_state != k_catalog_state_count) {
+        return;
+    }
+    const uint8_t room = CATALOG_MAX_UNITS - s_catalog_base(s_type);
+    s_counts[s_type] = (reply->value.value < room) ? reply->value.value : room;
+    s_next = 0;
+    s_received = 0;
+    s_state = k_catalog_state_descs;
+}
+
+static void s_on_desc(nts1_status_t status, const nts1_rx_reply_t* reply, void* context) {
+    const uint16_t key = (uint16_t)(uintptr_t)context;
+    --s_in_flight;
+    if (status != k_nts1_status_ok || s_queued == CATALOG_WINDOW) {
+        return;  // sent again once the others are in
+    }
+    s_catalog_desc_t* desc = &s_queue[s_queued++];
+    desc->type = key >> 8;
+    desc->idx = key & 0xFF;
+    desc->param_count = reply->unit_desc.param_count;
+    memcpy(desc->name, reply->unit_desc.name, sizeof(desc->name));
+}
+
+static void s_request_descs(void) {
+    const uint8_t count = s_counts[s_type];
+    const uint8_t base = s_catalog_base(s_type);
+    while (s_next < count && s_in_flight + s_queued < CATALOG_WINDOW) {
+        if (CATALOG_ENTRIES[base + s_next] != CATALOG_ENTRY_EMPTY) {
+            ++s_next;
+            continue;
+        }
+        const uintptr_t key = (s_type << 8) | s_next;
+        if (nts1_request(k_nts1_tx_event_id_req_unit_desc, s_unit_ids[s_type], s_next,
+                         CATALOG_TIMEOUT_US, s_on_desc, (void*)key) != k_nts1_status_ok) {
+            break;
+        }
+        ++s_in_flight;
+        ++s_next;
+    }
+    if (s_next == count && !s_in_flight && !s_queued && s_received < count) {
+        s_next = 0;  // some timed out, go over the missing ones again
+    }
+}
+
+// ----------------------------------------------------
+
+void nts1_catalog_init(void) {
+    s_ready = CATALOG_HEADER->magic == CATALOG_MAGIC;
+    if (s_ready) {
+        memcpy(s_counts, CATALOG_HEADER->counts, sizeof(s_counts));
+        s_pool_size = CATALOG_HEADER->pool_size;
+    } else {
+        memset(s_counts, 0, sizeof(s_counts));
+        s_pool_size = 0;
+    }
+    s_state = k_catalog_state_version;
+    s_in_flight = 0;
+    s_queued = 0;
+    // a hold still waiting for the main board to stop
+    nts1_flash_end();
+}
+
+void nts1_catalog_idle(void) {
+    switch (s_state) {
+        case k_catalog_state_version:
+            if (!s_in_flight &&
+                nts1_request(k_nts1_tx_event_id_req_value, k_param_id_sys_version, 0,
+                             CATALOG_TIMEOUT_US, s_on_version, NULL) == k_nts1_status_ok) {
+                s_in_flight = 1;
+            }
+            break;
+        case k_catalog_state_erase:
+            if (nts1_flash_begin()) {
+                const uint16_t empty_name = 0;
+                if (s_flash_erase() &&
+                    s_flash_program(CATALOG_POOL_OFFSET, &empty_name, sizeof(empty_name))) {
+                    memset(s_counts, 0, sizeof(s_counts));
+                    s_pool_size = sizeof(empty_name);
+                    s_type = 0;
+                    s_state = k_catalog_state_count;
+                }
+                nts1_flash_end();
+            }
+            break;
+        case k_catalog_state_count:
+            if (s_type == k_nts1_num_unit_types) {
+                s_state = k_catalog_state_commit;
+            } else if (!s_in_flight &&
+                       nts1_request(k_nts1_tx_event_id_req_unit_count, s_unit_ids[s_type], 0,
+                                    CATALOG_TIMEOUT_US, s_on_count, NULL) == k_nts1_status_ok) {
+                s_in_flight = 1;
+            }
+            break;
+        case k_catalog_state_descs:
+            if (s_queued && nts1_flash_begin()) {
+                for (uint8_t i = 0; i < s_queued; ++i) {
+                    s_program_desc(&s_queue[i]);
+                }
+                s_queued = 0;
+                nts1_flash_end();
+            }
+            // requests sent again may still be out, the next type waits for them
+            if (s_received == s_counts[s_type] && !s_in_flight) {
+                ++s_type;
+                s_state = k_catalog_state_count;
+            } else {
+                s_request_descs();
+            }
+            break;
+        case k_catalog_state_commit:
+            if (nts1_flash_begin()) {
+                s_catalog_header_t header;
+                memset(&header, 0xFF, sizeof(header));
+                header.version = s_version;
+                header.pool_size = s_pool_size;
+                memcpy(header.counts, s_counts, sizeof(header.counts));
+                header.magic = CATALOG_MAGIC;
+                // the magic goes last
+                const uint16_t magic_offset = offsetof(s_catalog_header_t, magic);
+                if (s_flash_program(0, &header, magic_offset) &&
+                    s_flash_program(magic_offset, &header.magic, sizeof(header.magic))) {
+                    s_ready = true;
+                    s_state = k_catalog_state_done;
+                } else {
+                    s_state = k_catalog_state_erase;
+                }
+                nts1_flash_end();
+            }
+            break;
+        case k_catalog_state_done:
+        default:
+            break;
+    }
+}
+
+uint8_t nts1_catalog_ready(void) { return s_ready; }
+
+uint8_t nts1_catalog_unit_count(uint8_t type) {
+    return (type < k_nts1_num_unit_types) ? s_counts[type] : 0;
+}
+
+const char* nts1_catalog_unit_name(uint8_t type, uint8_t idx) {
+    if (type >= k_nts1_num_unit_types || idx >= s_counts[type]) {
+        return NULL;
+    }
+    const uint16_t entry = CATALOG_ENTRIES[s_catalog_base(type) + idx];
+    return (entry != CATALOG_ENTRY_EMPTY) ? &CATALOG_POOL[CATALOG_ENTRY_OFFSET(entry)] : NULL;
+}
+
+uint8_t nts1_catalog_unit_param_count(uint8_t type, uint8_t idx) {
+    if (type >= k_nts1_num_unit_types || idx >= s_counts[type]) {
+        return 0;
+    }
+    const uint16_t entry = CATALOG_ENTRIES[s_catalog_base(type) + idx];
+    return (entry != CATALOG_ENTRY_EMPTY) ? CATALOG_ENTRY_PARAMS(entry) : 0;
+}
@@ -0,0 +1,64 @@
+/**
+ * @file nts1_catalog.h
+ * @brief Unit descriptor catalog of the NTS-1 main board, kept in internal flash.
+ *
+ * Unit counts, names and parameter counts of every unit type are read from the main
+ * board in the background, a few requests at a time from nts1_catalog_idle(), and
+ * programmed to a flash region along with the main board version they were read from.
+ * After a reset the stored catalog is served right away and only read again if the main
+ * board reports another version.
+ *
+ * Names are interned in a string pool, units with the same name share it. Counts, names
+ * and parameter counts are available as soon as they are read, nts1_catalog_ready()
+ * tells when the whole catalog is there.
+ *
+ * nts1_catalog_init() goes after nts1_init(), nts1_catalog_idle() after nts1_idle() in
+ * loop(). Both and the lookups are for the main loop only.
+ */
+
+#ifndef __nts1_catalog_h
+#define __nts1_catalog_h
+
+#include <stdint.h>
+
+#include "stm32_def.h"
+
+// Flash region holding the catalog, whole pages the firmware image must stay clear of.
+// The last 2 KB of the 64 KB part by default. Other regions kept in flash go below it.
+#ifndef NTS1_CATALOG_FLASH_SIZE
+#define NTS1_CATALOG_FLASH_SIZE (2 * FLASH_PAGE_SIZE)
+#endif
+#ifndef NTS1_CATALOG_FLASH_ADDR
+#define NTS1_CATALOG_FLASH_ADDR (FLASH_BANK1_END + 1 - NTS1_CATALOG_FLASH_SIZE)
+#endif
+
+enum {
+  k_nts1_unit_type_osc = 0U,
+  k_nts1_unit_type_filt,
+  k_nts1_unit_type_ampeg,
+  k_nts1_unit_type_mod,
+  k_nts1_unit_type_del,
+  k_nts1_unit_type_rev,
+  k_nts1_unit_type_arp_pattern,
+  k_nts1_unit_type_arp_intervals,
+  k_nts1_num_unit_types,
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  void nts1_catalog_init(void);
+  void nts1_catalog_idle(void);
+
+  uint8_t nts1_catalog_ready(void);
+  uint8_t nts1_catalog_unit_count(uint8_t type);
+  // NULL until the descriptor has been read
+  const char *nts1_catalog_unit_name(uint8_t type, uint8_t idx);
+  uint8_t nts1_catalog_unit_param_count(uint8_t type, uint8_t idx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __nts1_catalog_h
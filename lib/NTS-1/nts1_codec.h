@@ -0,0 +1,150 @@
+/**
+ * @file nts1_codec.h
+ * @brief 7 bit / 8 bit codec kernels behind nts1_convert_7to8() and nts1_convert_8to7().
+ *
+ * The 8 bit data is a little endian bit stream cut into 7 bit bytes, so every 7 bytes
+ * make a group of 8 7-bit bytes. Whole groups go through the block kernels, which have
+ * no per byte branches. Only the tail that does not fill a group is done byte by byte.
+ *
+ * NTS1_CODEC_SWAR picks the block kernels: 1 holds a group in one 64 bit register, 0 in
+ * two 32 bit ones. It defaults to 1 on 64 bit little endian hosts only, the F0 has no 64
+ * bit shifts. Everything here is static inline so a translation unit can be built with
+ * either setting, the host tests build both.
+ */
+
+#ifndef __nts1_codec_h
+#define __nts1_codec_h
+
+#include <stdint.h>
+#include <string.h>
+
+#include "nts1_iface.h"
+
+#ifndef NTS1_CODEC_SWAR
+#if defined(__SIZEOF_POINTER__) && __SIZEOF_POINTER__ >= 8 && defined(__BYTE_ORDER__) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define NTS1_CODEC_SWAR 1  // 64 bit little endian host: a group in one register
+#else
+#define NTS1_CODEC_SWAR 0  // 32 bit target: a group in two registers, no 64 bit shifts
+#endif
+#endif
+
+#if NTS1_CODEC_SWAR
+
+// Lanes are halved three times, 56 bits -> 2 x 28 -> 4 x 14 -> 8 x 7, and back
+static inline void nts1_codec_block_7to8(uint8_t* dest8, const uint8_t* src7) {
+    uint64_t x;
+    memcpy(&x, src7, 8);
+    x &= 0x7F7F7F7F7F7F7F7FULL;
+    x = ((x >> 1) & 0x3F803F803F803F80ULL) | (x & 0x007F007F007F007FULL);
+    x = ((x >> 2) & 0x0FFFC0000FFFC000ULL) | (x & 0x00003FFF00003FFFULL);
+    x = ((x >> 4) & 0x00FFFFFFF0000000ULL) | (x & 0x000000000FFFFFFFULL);
+    memcpy(dest8, &x, 7);
+}
+
+static inline void nts1_codec_block_8to7(uint8_t* dest7, const uint8_t* src8) {
+    uint64_t x = 0;
+    memcpy(&x, src8, 7);
+    x = ((x & 0x00FFFFFFF0000000ULL) << 4) | (x & 0x000000000FFFFFFFULL);
+    x = ((x & 0x0FFFC0000FFFC000ULL) << 2) | (x & 0x00003FFF00003FFFULL);
+    x = ((x & 0x3F803F803F803F80ULL) << 1) | (x & 0x007F007F007F007FULL);
+    memcpy(dest7, &x, 8);
+}
+
+#else
+
+static inline void nts1_codec_block_7to8(uint8_t* dest8, const uint8_t* src7) {
+    const uint32_t lo = (uint32_t)(src7[0] & 0x7F) | (uint32_t)(src7[1] & 0x7F) << 7 |
+                        (uint32_t)(src7[2] & 0x7F) << 14 | (uint32_t)(src7[3] & 0x7F) << 21 |
+                        (uint32_t)src7[4] << 28;
+    const uint32_t hi = (uint32_t)(src7[4] & 0x7F) >> 4 | (uint32_t)(src7[5] & 0x7F) << 3 |
+                        (uint32_t)(src7[6] & 0x7F) << 10 | (uint32_t)(src7[7] & 0x7F) << 17;
+    dest8[0] = lo;
+    dest8[1] = lo >> 8;
+    dest8[2] = lo >> 16;
+    dest8[3] = lo >> 24;
+    dest8[4] = hi;
+    dest8[5] = hi >> 8;
+    dest8[6] = hi >> 16;
+}
+
+static inline void nts1_codec_block_8to7(uint8_t* dest7, const uint8_t* src8) {
+    const uint32_t lo = (uint32_t)src8[0] | (uint32_t)src8[1] << 8 | (uint32_t)src8[2] << 16 |
+                        (uint32_t)src8[3] << 24;
+    const uint32_t hi = (uint32_t)src8[4] | (uint32_t)src8[5] << 8 | (uint32_t)src8[6] << 16;
+    dest7[0] = lo & 0x7F;
+    dest7[1] = (lo >> 7) & 0x7F;
+    dest7[2] = (lo >> 14) & 0x7F;
+    dest7[3] = (lo >> 21) & 0x7F;
+    dest7[4] = ((lo >> 28) | (hi << 4)) & 0x7F;
+    dest7[5] = (hi >> 3) & 0x7F;
+    dest7[6] = (hi >> 10) & 0x7F;
+    dest7[7] = (hi >> 17) & 0x7F;
+}
+
+#endif
+
+static inline void nts1_codec_bytes_7to8(uint8_t* dest8, const uint8_t* src7, uint32_t size7) {
+    for (uint32_t i7 = 0, i8 = 0; i7 < size7; ++i7) {
+        const uint8_t i7mod8 = i7 % 8;
+        switch (i7mod8) {
+            case 0:
+                dest8[i8++] = src7[i7] & 0x7F;
+                break;
+            case 7:
+                dest8[i8 - 1] |= (src7[i7] & 0x7F) << 1;
+                break;
+            default: {
+                const uint8_t offset = 8 - i7mod8;
+                const uint8_t src = src7[i7];
+                dest8[i8 - 1] |= (src & ((1U << i7mod8) - 1)) << offset;
+                dest8[i8++] = (src & 0x7F) >> i7mod8;
+            } break;
+        }
+    }
+}
+
+static inline void nts1_codec_bytes_8to7(uint8_t* dest7, const uint8_t* src8, uint32_t size8) {
+    const uint32_t size7 = nts1_size_8to7(size8);
+    for (uint32_t i7 = 0, i8 = 0; i7 < size7; ++i7) {
+        const uint8_t i7mod8 = i7 % 8;
+        switch (i7mod8) {
+            case 0:
+                dest7[i7] = src8[i8++] & 0x7F;
+                break;
+            case 7:
+                dest7[i7] = (src8[i8 - 1] & (0x7F << 1)) >> 1;
+                break;
+            default: {
+                const uint8_t offset = 8 - i7mod8;
+                uint8_t dest = (src8[i8 - 1] & (0xFFU << offset)) >> offset;
+                dest |= (src8[i8++] & (0x7F >> i7mod8)) << i7mod8;
+                dest7[i7] = dest;
+            } break;
+        }
+    }
+}
+
+static inline uint32_t nts1_codec_7to8(uint8_t* dest8, const uint8_t* src7, uint32_t size7) {
+    const uint32_t size8 = nts1_size_7to8(size7);
+    for (uint32_t groups = size7 / 8; groups; --groups) {
+        nts1_codec_block_7to8(dest8, src7);
+        dest8 += 7;
+        src7 += 8;
+    }
+    nts1_codec_bytes_7to8(dest8, src7, size7 % 8);
+    return size8;
+}
+
+static inline uint32_t nts1_codec_8to7(uint8_t* dest7, const uint8_t* src8, uint32_t size8) {
+    const uint32_t size7 = nts1_size_8to7(size8);
+    for (uint32_t groups = size8 / 7; groups; --groups) {
+        nts1_codec_block_8to7(dest7, src8);
+        dest7 += 8;
+        src8 += 7;
+    }
+    nts1_codec_bytes_8to7(dest7, src8, size8 % 7);
+    return size7;
+}
+
+#endif  // __nts1_codec_h
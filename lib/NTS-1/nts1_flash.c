@@ -0,0 +1,77 @@
+/**
+ * @file nts1_flash.c
+ * @brief Internal flash programming alongside the NTS-1 main board link.
+ */
+
+#include "nts1_flash.h"
+
+#include "clock.h"
+#include "nts1_iface.h"
+#include "stm32_def.h"
+#include "stm32f0xx_hal.h"
+
+// If the main board keeps clocking, flash is programmed anyway after this long
+#ifndef NTS1_FLASH_HOLD_TIMEOUT_US
+#define NTS1_FLASH_HOLD_TIMEOUT_US (5000)
+#endif
+
+#ifndef true
+#define true 1
+#endif
+
+#ifndef false
+#define false 0
+#endif
+
+// ----------------------------------------------------
+
+static uint8_t s_holding;
+static uint32_t s_hold_stamp;
+
+// ----------------------------------------------------
+
+// Returns true once the main board has stopped clocking, or has been given long enough
+uint8_t nts1_flash_begin(void) {
+    const uint32_t now = getCurrentMicros();
+    if (!s_holding) {
+        nts1_hold_main_board(true);
+        s_holding = true;
+        s_hold_stamp = now;
+        return false;
+    }
+    if (!nts1_main_board_quiet() && now - s_hold_stamp < NTS1_FLASH_HOLD_TIMEOUT_US) {
+        return false;
+    }
+    HAL_FLASH_Unlock();
+    return true;
+}
+
+// Also gives up a hold begun by nts1_flash_begin() that has not returned true yet
+void nts1_flash_end(void) {
+    if (!s_holding) {
+        return;
+    }
+    HAL_FLASH_Lock();
+    nts1_hold_main_board(false);
+    s_holding = false;
+}
+
+uint8_t nts1_flash_program(uintptr_t address, const void* data, uint16_t size) {
+    const uint8_t* src = (const uint8_t*)data;
+    for (uint16_t i = 0; i < size; i += 2) {
+        const uint16_t half = src[i] | (src[i + 1] << 8);
+        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, address + i, half) != HAL_OK) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint8_t nts1_flash_erase(uintptr_t address, uint16_t pages) {
+    FLASH_EraseInitTypeDef erase;
+    erase.TypeErase = FLASH_TYPEERASE_PAGES;
+    erase.PageAddress = address;
+    erase.NbPages = pages;
+    uint32_t page_error;
+    return HAL_FLASHEx_Erase(&erase, &page_error) == HAL_OK;
+}
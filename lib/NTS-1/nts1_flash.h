@@ -0,0 +1,34 @@
+/**
+ * @file nts1_flash.h
+ * @brief Internal flash programming alongside the NTS-1 main board link.
+ *
+ * Programming and erasing stall the CPU, interrupts included, so the main board is held
+ * off (ACK low) first and flash is only unlocked once it has stopped clocking, or after
+ * NTS1_FLASH_HOLD_TIMEOUT_US. nts1_flash_begin() returns false until then and is called
+ * again from the next loop(), nts1_flash_end() locks flash and lets the main board go,
+ * or gives up a hold that has not got that far.
+ * Keep the work between the two short, a page erase or a few dozen half words.
+ *
+ * Regions are whole pages the firmware image must stay clear of. For the main loop only.
+ */
+
+#ifndef __nts1_flash_h
+#define __nts1_flash_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  uint8_t nts1_flash_begin(void);
+  void nts1_flash_end(void);
+  // size even, programmed a half word at a time to erased flash
+  uint8_t nts1_flash_program(uintptr_t address, const void *data, uint16_t size);
+  uint8_t nts1_flash_erase(uintptr_t address, uint16_t pages);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __nts1_flash_h
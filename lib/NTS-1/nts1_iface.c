@@ -34,15 +34,19 @@
 #include "nts1_iface.h"
 
 #include <assert.h>
+#include <string.h>
 #include <utility/spi_com.h>
 
 #include "PeripheralPins.h"
 #include "PinAF_STM32F1.h"
+#include "clock.h"
 #include "pinconfig.h"
 #include "stm32_def.h"
 #include "stm32f0xx_hal.h"
 #include "stm32f0xx_hal_def.h"
 #include "stm32f0xx_hal_spi.h"
+#include "spsc_ring.h"
+#include "nts1_codec.h"
 
 #define SPI_PERIPH SPI2
 #define SPI_MISO_PORT GPIOB
@@ -63,6 +67,21 @@
 #define SPI_CLK_ENABLE() __HAL_RCC_SPI2_CLK_ENABLE()
 #define SPI_CLK_DISABLE() __HAL_RCC_SPI2_CLK_DISABLE()
 
+// SPI transport: 0 takes one SPI interrupt per byte, 1 moves bytes with circular DMA
+// and only interrupts on half/full transfer
+#ifndef NTS1_SPI_USE_DMA
+#define NTS1_SPI_USE_DMA 0
+#endif
+
+#define SPI_DMA_RX_CH DMA1_Channel4
+#define SPI_DMA_TX_CH DMA1_Channel5
+#define SPI_DMA_IRQn DMA1_Channel4_5_IRQn
+#define SPI_DMA_IRQ_HANDLER DMA1_Channel4_5_IRQHandler
+#define SPI_DMA_CLK_ENABLE() __HAL_RCC_DMA1_CLK_ENABLE()
+
+#define SPI_DMA_RX_FLAGS (DMA_ISR_HTIF4 | DMA_ISR_TCIF4)
+#define SPI_DMA_TX_FLAGS (DMA_ISR_HTIF5 | DMA_ISR_TCIF5)
+
 #define ACK_PORT GPIOB
 #define ACK_PIN GPIO_PIN_12
 
@@ -72,12 +91,79 @@
 #define PANEL_CMD_EMARK 0x40  // Bit  6
 #define PANEL_START_BIT 0x80  // Bit  7
 
+// Buffer sizes, powers of 2. Together they take most of the RAM the library uses, on
+// the 8 KB part smaller buffers leave room for the application at the cost of the host
+// being held off more often.
+#ifndef SPI_TX_BUF_SIZE
 #define SPI_TX_BUF_SIZE (0x200)
-#define SPI_TX_BUF_MASK (SPI_TX_BUF_SIZE - 1)
+#endif
+#ifndef SPI_TX_BULK_BUF_SIZE
+#define SPI_TX_BULK_BUF_SIZE (0x80)  // descriptor/value requests, 4 bytes each
+#endif
 
+#ifndef SPI_RX_BUF_SIZE
 #define SPI_RX_BUF_SIZE (0x200)
+#endif
 #define SPI_RX_BUF_MASK (SPI_RX_BUF_SIZE - 1)
 
+// RX flow control: the host is asked to wait (ACK low) once SPI_RX_ACK_HIGH bytes are
+// unread and let go again (ACK high) once parsing brings them down to SPI_RX_ACK_LOW.
+// The gap keeps ACK from toggling on every byte around a single threshold. With DMA the
+// level is only checked every half buffer, so a whole half must still fit above the
+// high watermark. Both can be changed at runtime with nts1_set_rx_ack_watermarks().
+#ifndef SPI_RX_ACK_HIGH
+#if NTS1_SPI_USE_DMA
+#define SPI_RX_ACK_HIGH (SPI_RX_BUF_SIZE / 2 - 32)
+#else
+#define SPI_RX_ACK_HIGH (SPI_RX_BUF_SIZE - 32)
+#endif
+#endif
+
+#ifndef SPI_RX_ACK_LOW
+#define SPI_RX_ACK_LOW (SPI_RX_ACK_HIGH / 2)
+#endif
+
+// Largest rx command, its size byte is 7 bit. It has to fit below the high watermark or
+// it can never complete while the host is held off. The high watermark goes up to the
+// whole ring, only half of it with DMA: a full ring reads as empty there.
+#define RX_CMD_MAX_SIZE (127)
+#if NTS1_SPI_USE_DMA
+#define SPI_RX_ACK_HIGH_MAX (SPI_RX_BUF_SIZE / 2)
+#else
+#define SPI_RX_ACK_HIGH_MAX (SPI_RX_BUF_SIZE)
+#endif
+
+// TX DMA ping-pong buffer, one half is refilled while the other is sent
+#define SPI_TX_DMA_HALF_SIZE (16)
+
+// Parameter changes wait in a staging table, one slot per (id, subid) holding the latest
+// value, and only move to the tx buffer while fewer than SPI_TX_PARAM_FLUSH_LEVEL bytes
+// are queued there. A moving knob then never has more than one value in flight per
+// parameter and notes don't queue up behind stale values.
+#define PARAM_STAGE_SIZE (16)
+#define SPI_TX_PARAM_FLUSH_LEVEL (64)
+
+// The main board counts as stopped once it has clocked no byte for this long after being
+// held off with nts1_hold_main_board()
+#ifndef NTS1_HOLD_QUIET_US
+#define NTS1_HOLD_QUIET_US (64)
+#endif
+
+// Requests sent with nts1_request() hold a slot until their reply arrives or their
+// deadline passes, at most 32. This also bounds what they can queue on the bulk lane.
+#ifndef NTS1_MAX_PENDING_REQUESTS
+#define NTS1_MAX_PENDING_REQUESTS (8)
+#endif
+
+// Rx bytes and microseconds of parsing per nts1_idle() call, 0 for no limit. What is
+// left over is parsed by the next call. Can be changed with nts1_set_idle_budget().
+#ifndef NTS1_IDLE_RX_BUDGET_BYTES
+#define NTS1_IDLE_RX_BUDGET_BYTES (0)
+#endif
+#ifndef NTS1_IDLE_RX_BUDGET_US
+#define NTS1_IDLE_RX_BUDGET_US (0)
+#endif
+
 #ifndef true
 #define true 1
 #endif
@@ -130,98 +216,296 @@ static uint8_t s_dummy_tx_cmd = (PANEL_ID_MASK + 0xC7);  // B'11ppp111;
 
 static uint8_t s_started;
 
-static uint8_t s_spi_tx_buf[SPI_TX_BUF_SIZE];
-static uint16_t s_spi_tx_ridx;  // Read  Index (from s_spi_tx_buf)
-static uint16_t s_spi_tx_widx;  // Write Index (to s_spi_tx_buf)
+// TX: queued by the API (producer), sent by the SPI/DMA interrupt (consumer). Notes,
+//     parameter changes and protocol replies use the realtime lane, requests for
+//     descriptors and values the bulk lane, which is only sent while realtime is empty.
+// RX: filled by the SPI interrupt or DMA (producer), parsed by nts1_idle() (consumer)
+SPSC_RING_DEFINE(spi_tx_ring, uint8_t, SPI_TX_BUF_SIZE)
+SPSC_RING_DEFINE(spi_tx_bulk_ring, uint8_t, SPI_TX_BULK_BUF_SIZE)
+SPSC_RING_DEFINE(spi_rx_ring, uint8_t, SPI_RX_BUF_SIZE)
+
+static spi_tx_ring_t s_spi_tx;
+static spi_tx_bulk_ring_t s_spi_tx_bulk;
+static spi_rx_ring_t s_spi_rx;
+
+static uint8_t s_spi_tx_lane;    // lane of the command on the wire
+static uint16_t s_spi_tx_clock;  // bytes sent, dummies included
+
+// Queuing to sending delay is sampled one command per lane at a time
+typedef struct {
+    uint16_t end;    // lane write index after the sampled command
+    uint16_t stamp;  // s_spi_tx_clock when it was queued
+    uint8_t active;
+} s_tx_lane_probe_t;
+
+static s_tx_lane_probe_t s_tx_lane_probes[k_nts1_num_tx_lanes];
+static nts1_tx_lane_stats_t s_tx_lane_stats[k_nts1_num_tx_lanes];
+
+#if NTS1_SPI_USE_DMA
+static uint8_t s_spi_tx_dma_buf[2 * SPI_TX_DMA_HALF_SIZE];
+#endif
+
+static nts1_tx_param_change_t s_param_stage[PARAM_STAGE_SIZE];
+static uint32_t s_param_stage_pending;  // 1 bit per slot
 
-static uint8_t s_spi_rx_buf[SPI_RX_BUF_SIZE];
-static uint16_t s_spi_rx_ridx;  // Read  Index (from s_spi_rx_buf)
-static uint16_t s_spi_rx_widx;  // Write Index (to s_spi_rx_buf)
+typedef struct {
+    nts1_reply_handler handler;
+    void* context;
+    uint32_t deadline;  // getCurrentMicros()
+    uint8_t event_id;   // k_nts1_tx_event_id_req_*, echoed as req_id by value events
+    uint8_t main_id;
+    uint8_t sub_id;
+} s_request_t;
 
-static uint8_t s_panel_rx_status;
-static uint8_t s_panel_rx_data_cnt;
-static uint8_t s_panel_rx_data[127];
+static s_request_t s_requests[NTS1_MAX_PENDING_REQUESTS];
+static uint32_t s_requests_pending;  // 1 bit per slot
 
-// ----------------------------------------------------
+static uint16_t s_rx_ack_high = SPI_RX_ACK_HIGH;
+static uint16_t s_rx_ack_low = SPI_RX_ACK_LOW;
+
+typedef char s_rx_buf_size_check[(SPI_RX_BUF_SIZE >= 128 + RX_CMD_MAX_SIZE) ? 1 : -1];
+typedef char s_rx_ack_watermark_check[(SPI_RX_ACK_LOW < SPI_RX_ACK_HIGH &&
+                                       SPI_RX_ACK_HIGH >= RX_CMD_MAX_SIZE &&
+                                       SPI_RX_ACK_HIGH <= SPI_RX_ACK_HIGH_MAX) ? 1 : -1];
 
-#define SPI_TX_BUF_RESET() (s_spi_tx_ridx = s_spi_tx_widx = 0)
-#define SPI_TX_BUF_EMPTY() ((SPI_TX_BUF_MASK & s_spi_tx_ridx) == (SPI_TX_BUF_MASK & s_spi_tx_widx))
-#define SPI_RX_BUF_RESET() (s_spi_rx_ridx = s_spi_rx_widx = 0)
-#define SPI_RX_BUF_EMPTY() ((SPI_RX_BUF_MASK & s_spi_rx_ridx) == (SPI_RX_BUF_MASK & s_spi_rx_widx))
+static nts1_link_stats_t s_link_stats;
+static uint8_t s_ack_waiting;
+static uint32_t s_ack_wait_stamp;  // getCurrentMicros() when ACK went low
+static uint8_t s_ack_hold;         // ACK kept low whatever the rx level
+static uint32_t s_hold_rx_pos;     // receive position last seen while held
+static uint32_t s_hold_rx_stamp;   // getCurrentMicros() when it last moved
 
-#define SPI_BUF_INC(idx, bufSize) (((idx + 1) == bufSize) ? 0 : idx + 1)
+static nts1_idle_stats_t s_idle_stats = {.budget_bytes = NTS1_IDLE_RX_BUDGET_BYTES,
+                                         .budget_us = NTS1_IDLE_RX_BUDGET_US};
+static uint8_t s_rx_parsing;  // set while s_rx_parse() runs, handlers may call nts1_idle()
 
 // ----------------------------------------------------
 
-static inline void s_port_startup_ack(void) { ACK_PORT->BSRR = ACK_PIN; }
+#define SPI_TX_BUF_RESET() (spi_tx_ring_reset(&s_spi_tx), spi_tx_bulk_ring_reset(&s_spi_tx_bulk))
+#define SPI_TX_BUF_EMPTY() (s_spi_tx_count(k_nts1_tx_lane_realtime) == 0 && \
+                            s_spi_tx_count(k_nts1_tx_lane_bulk) == 0)
+#define SPI_RX_BUF_RESET() spi_rx_ring_reset(&s_spi_rx)
+#define SPI_RX_BUF_EMPTY() (spi_rx_ring_count(&s_spi_rx) == 0)
 
-static inline void s_port_wait_ack(void) { ACK_PORT->BRR = ACK_PIN; }
+// ----------------------------------------------------
+
+// Called with interrupts masked or from the SPI/DMA interrupt. Only level changes are
+// timed, the pin itself is written every time.
+static inline void s_port_startup_ack(void) {
+    ACK_PORT->BSRR = ACK_PIN;
+    if (s_ack_waiting) {
+        s_ack_waiting = false;
+        const uint32_t wait_us = getCurrentMicros() - s_ack_wait_stamp;
+        s_link_stats.ack_wait_us += wait_us;
+        if (wait_us > s_link_stats.ack_wait_max_us) {
+            s_link_stats.ack_wait_max_us = wait_us;
+        }
+    }
+}
+
+static inline void s_port_wait_ack(void) {
+    ACK_PORT->BRR = ACK_PIN;
+    if (!s_ack_waiting) {
+        s_ack_waiting = true;
+        s_ack_wait_stamp = getCurrentMicros();
+        ++s_link_stats.ack_waits;
+    }
+}
 
 // ----------------------------------------------------
 
+// 8 bit access to DR, a 16 bit access would move two bytes through the FIFO
 static inline void s_spi_raw_fifo_push8(SPI_TypeDef* SPIx, uint8_t data) {
-    const uint32_t spix_dr = (uint32_t)SPIx + 0x0C;
-    *(__IO uint8_t*)spix_dr = data;
+    *(__IO uint8_t*)&SPIx->DR = data;
 }
 
 static inline uint8_t s_spi_raw_fifo_pop8(SPI_TypeDef* SPIx) {
-    const uint32_t spix_dr = (uint32_t)SPIx + 0x0C;
-    return *(__IO uint8_t*)spix_dr;
+    return *(__IO uint8_t*)&SPIx->DR;
 }
 
-static uint8_t s_spi_chk_rx_buf_space(uint16_t size) {
-    uint16_t count;
+static inline uint8_t s_spi_chk_rx_buf_space(uint16_t size) {
+    return spi_rx_ring_space(&s_spi_rx) >= size;
+}
+
+// ACK follows the unread rx bytes, with hysteresis between the watermarks
+static inline void s_port_update_ack(uint16_t depth) {
+    if (depth >= s_rx_ack_high || s_ack_hold) {
+        s_port_wait_ack();
+    } else if (depth <= s_rx_ack_low) {
+        s_port_startup_ack();
+    }
+}
+
+static inline uint16_t s_spi_tx_count(uint8_t lane) {
+    return (lane == k_nts1_tx_lane_bulk) ? spi_tx_bulk_ring_count(&s_spi_tx_bulk)
+                                         : spi_tx_ring_count(&s_spi_tx);
+}
+
+static inline uint16_t s_spi_tx_widx(uint8_t lane) {
+    return (lane == k_nts1_tx_lane_bulk) ? s_spi_tx_bulk.widx : s_spi_tx.widx;
+}
+
+static inline uint16_t s_spi_tx_ridx(uint8_t lane) {
+    return (lane == k_nts1_tx_lane_bulk) ? s_spi_tx_bulk.ridx : s_spi_tx.ridx;
+}
+
+static inline uint8_t s_spi_chk_tx_buf_space(uint8_t lane, uint16_t size) {
+    return (lane == k_nts1_tx_lane_bulk) ? spi_tx_bulk_ring_space(&s_spi_tx_bulk) >= size
+                                         : spi_tx_ring_space(&s_spi_tx) >= size;
+}
 
-    if (s_spi_rx_ridx <= s_spi_rx_widx) {
-        count = (SPI_RX_BUF_SIZE + s_spi_rx_ridx) - s_spi_rx_widx;
+// Several contexts queue tx commands (main loop, timer interrupts, replies from the rx
+// parser). Each one writes and publishes its commands with interrupts masked, which
+// keeps the tx ring single producer and commands from interleaving. Only the few cycles
+// of copying bytes are spent masked.
+static inline uint32_t s_spi_tx_lock(void) {
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    return primask;
+}
+
+static inline void s_spi_tx_unlock(uint32_t primask) { __set_PRIMASK(primask); }
+
+// Queue a whole command, published at once so the consumer never sees part of it
+static uint8_t s_spi_tx_buf_write(uint8_t lane, const uint8_t* data, uint16_t size) {
+    nts1_tx_lane_stats_t* stats = &s_tx_lane_stats[lane];
+    const uint32_t primask = s_spi_tx_lock();
+    if (!s_spi_chk_tx_buf_space(lane, size)) {
+        ++stats->refused;
+        ++s_link_stats.tx_dropped_frames;
+        s_spi_tx_unlock(primask);
+        return false;
+    }
+    if (lane == k_nts1_tx_lane_bulk) {
+        for (uint16_t i = 0; i < size; ++i) {
+            spi_tx_bulk_ring_poke(&s_spi_tx_bulk, i, data[i]);
+        }
+        spi_tx_bulk_ring_commit(&s_spi_tx_bulk, size);
     } else {
-        count = s_spi_rx_ridx - s_spi_rx_widx;
+        for (uint16_t i = 0; i < size; ++i) {
+            spi_tx_ring_poke(&s_spi_tx, i, data[i]);
+        }
+        spi_tx_ring_commit(&s_spi_tx, size);
+    }
+
+    ++stats->commands;
+    const uint16_t depth = s_spi_tx_count(lane);
+    if (depth > stats->max_depth) {
+        stats->max_depth = depth;
+    }
+    const uint16_t total_depth =
+        s_spi_tx_count(k_nts1_tx_lane_realtime) + s_spi_tx_count(k_nts1_tx_lane_bulk);
+    if (total_depth > s_link_stats.tx_max_depth) {
+        s_link_stats.tx_max_depth = total_depth;
+    }
+    s_tx_lane_probe_t* probe = &s_tx_lane_probes[lane];
+    if (!probe->active) {
+        probe->end = s_spi_tx_widx(lane);
+        probe->stamp = s_spi_tx_clock;
+        probe->active = true;
     }
-    return (count > size);
+    s_spi_tx_unlock(primask);
+    return true;
 }
 
+#if !NTS1_SPI_USE_DMA
+
 static uint8_t s_spi_rx_buf_write(uint8_t data) {
-    uint16_t bufdatacount;
-    if (s_spi_rx_ridx <= s_spi_rx_widx) {
-        bufdatacount = s_spi_rx_widx - s_spi_rx_ridx;
-    } else {
-        bufdatacount = SPI_RX_BUF_SIZE + s_spi_rx_widx - s_spi_rx_ridx;
+    ++s_link_stats.rx_bytes;
+    if (!s_spi_chk_rx_buf_space(1)) {
+        ++s_link_stats.rx_overruns;
+        return false;
     }
-    if (bufdatacount < (SPI_RX_BUF_SIZE - 2)) {
-        s_spi_rx_buf[SPI_RX_BUF_MASK & s_spi_rx_widx] = data;
-        s_spi_rx_widx = SPI_BUF_INC(s_spi_rx_widx, SPI_RX_BUF_SIZE);
-        return true;
+    spi_rx_ring_put(&s_spi_rx, data);
+    const uint16_t depth = spi_rx_ring_count(&s_spi_rx);
+    if (depth > s_link_stats.rx_max_depth) {
+        s_link_stats.rx_max_depth = depth;
     }
-    return false;
+    return true;
+}
+
+#endif
+
+static inline uint8_t s_spi_tx_peek(uint8_t lane) {
+    return (lane == k_nts1_tx_lane_bulk) ? spi_tx_bulk_ring_peek(&s_spi_tx_bulk, 0)
+                                         : spi_tx_ring_peek(&s_spi_tx, 0);
 }
 
-static uint8_t s_spi_rx_buf_read(void) {
-    const uint8_t data = s_spi_rx_buf[SPI_RX_BUF_MASK & s_spi_rx_ridx];
-    s_spi_rx_ridx = SPI_BUF_INC(s_spi_rx_ridx, SPI_RX_BUF_SIZE);
-    return data;
+static inline uint8_t s_spi_tx_get(uint8_t lane) {
+    return (lane == k_nts1_tx_lane_bulk) ? spi_tx_bulk_ring_get(&s_spi_tx_bulk)
+                                         : spi_tx_ring_get(&s_spi_tx);
 }
 
-static uint8_t s_spi_chk_tx_buf_space(uint16_t size) {
-    uint16_t count;
-    if (s_spi_tx_ridx <= s_spi_tx_widx) {
-        count = SPI_TX_BUF_SIZE + s_spi_tx_ridx - s_spi_tx_widx;
-    } else {
-        count = s_spi_tx_ridx - s_spi_tx_widx;
+// Next byte to put on the wire, from the tx buffer or a dummy when it is empty
+static uint8_t s_spi_tx_next(void) {
+    ++s_spi_tx_clock;
+
+    // a command is never split, lanes are only switched when the next byte is a status
+    uint8_t lane = s_spi_tx_lane;
+    if (!s_spi_tx_count(lane) || (s_spi_tx_peek(lane) & 0x80)) {
+        lane = s_spi_tx_count(k_nts1_tx_lane_realtime) ? k_nts1_tx_lane_realtime
+                                                        : k_nts1_tx_lane_bulk;
+        s_spi_tx_lane = lane;
+    }
+
+    if (!s_spi_tx_count(lane)) {  // 送信バッファーが空なのでダミーをセットする。
+        return s_dummy_tx_cmd;
+    }
+    uint8_t txdata = s_spi_tx_get(lane);
+    ++s_link_stats.tx_bytes;
+
+    s_tx_lane_probe_t* probe = &s_tx_lane_probes[lane];
+    if (probe->active && s_spi_tx_ridx(lane) == probe->end) {
+        // last byte of the sampled command
+        nts1_tx_lane_stats_t* stats = &s_tx_lane_stats[lane];
+        stats->last_wait = (uint16_t)(s_spi_tx_clock - probe->stamp);
+        if (stats->last_wait > stats->max_wait) {
+            stats->max_wait = stats->last_wait;
+        }
+        probe->active = false;
     }
-    return (count > size);
+
+    if (txdata & 0x80) {  // Statusの時は、EndMarkを付加するかチェックする。
+        if (!SPI_TX_BUF_EMPTY()) {  // 送信Bufferに次に送信するデータあり
+            txdata |= PANEL_CMD_EMARK;
+            // Note: this will set endmark on almost any status, especially those who have
+            // pending data,
+            //       which seems to contradict the endmark common usage of marking only the last
+            //       command of a group
+        }
+    }
+    return txdata;
 }
 
-static void s_spi_tx_buf_write(uint8_t data) {
-    s_spi_tx_buf[SPI_TX_BUF_MASK & s_spi_tx_widx] = data;
-    s_spi_tx_widx = SPI_BUF_INC(s_spi_tx_widx, SPI_TX_BUF_SIZE);
+#if NTS1_SPI_USE_DMA
+
+// The rx DMA channel is the producer, its write position follows from the transfer
+// count. Flow control keeps it from lapping the reader, so the distance from the read
+// index is the number of unread bytes.
+static inline uint16_t s_spi_rx_dma_count(void) {
+    const uint16_t pos = SPI_RX_BUF_SIZE - SPI_DMA_RX_CH->CNDTR;
+    return (pos - s_spi_rx.ridx) & SPI_RX_BUF_MASK;
 }
 
-static uint8_t s_spi_tx_buf_read(void) {
-    const uint8_t data = s_spi_tx_buf[SPI_TX_BUF_MASK & s_spi_tx_ridx];
-    s_spi_tx_ridx = SPI_BUF_INC(s_spi_tx_ridx, SPI_TX_BUF_SIZE);
-    return data;
+// Publish the DMA write position as the ring's write index, nts1_idle() only
+static inline void s_spi_rx_dma_sync(void) {
+    const uint16_t depth = s_spi_rx_dma_count();
+    const uint16_t widx = (uint16_t)(s_spi_rx.ridx + depth);
+    s_link_stats.rx_bytes += (uint16_t)(widx - s_spi_rx.widx);
+    s_spi_rx.widx = widx;
+    if (depth > s_link_stats.rx_max_depth) {
+        s_link_stats.rx_max_depth = depth;
+    }
 }
 
+static void s_spi_tx_dma_fill(uint8_t* half) {
+    for (uint8_t i = 0; i < SPI_TX_DMA_HALF_SIZE; ++i) {
+        half[i] = s_spi_tx_next();
+    }
+}
+
+#endif
+
 // ----------------------------------------------------
 
 static inline void s_spi_struct_init(SPI_InitTypeDef* SPI_InitStruct) {
@@ -263,6 +547,40 @@ static inline void s_spi_enable_pins() {
     HAL_GPIO_Init(SPI_SCK_PORT, &gpio);
 }
 
+#if NTS1_SPI_USE_DMA
+
+static void s_spi_dma_init(void) {
+    SPI_DMA_CLK_ENABLE();
+
+    // RX DMA must be enabled before the channels are set up (RM0360 28.5.8)
+    SPI_PERIPH->CR2 |= SPI_CR2_RXDMAEN;
+
+    // SPI -> rx buffer, wraps around forever
+    SPI_DMA_RX_CH->CCR = 0;
+    SPI_DMA_RX_CH->CPAR = (uint32_t)&SPI_PERIPH->DR;
+    SPI_DMA_RX_CH->CMAR = (uint32_t)s_spi_rx.buf;
+    SPI_DMA_RX_CH->CNDTR = SPI_RX_BUF_SIZE;
+    SPI_DMA_RX_CH->CCR =
+        DMA_CCR_PL_1 | DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_HTIE | DMA_CCR_TCIE | DMA_CCR_EN;
+
+    // ping-pong buffer -> SPI, start with dummies
+    s_spi_tx_dma_fill(s_spi_tx_dma_buf);
+    s_spi_tx_dma_fill(s_spi_tx_dma_buf + SPI_TX_DMA_HALF_SIZE);
+    SPI_DMA_TX_CH->CCR = 0;
+    SPI_DMA_TX_CH->CPAR = (uint32_t)&SPI_PERIPH->DR;
+    SPI_DMA_TX_CH->CMAR = (uint32_t)s_spi_tx_dma_buf;
+    SPI_DMA_TX_CH->CNDTR = 2 * SPI_TX_DMA_HALF_SIZE;
+    SPI_DMA_TX_CH->CCR = DMA_CCR_PL_1 | DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_DIR |
+                         DMA_CCR_HTIE | DMA_CCR_TCIE | DMA_CCR_EN;
+
+    SPI_PERIPH->CR2 |= SPI_CR2_TXDMAEN;
+
+    HAL_NVIC_SetPriority(SPI_DMA_IRQn, SPI_IRQ_PRIORITY, 0);
+    HAL_NVIC_EnableIRQ(SPI_DMA_IRQn);
+}
+
+#endif
+
 HAL_StatusTypeDef s_spi_init() {
     __HAL_RCC_SYSCFG_CLK_ENABLE();
 
@@ -280,15 +598,18 @@ HAL_StatusTypeDef s_spi_init() {
         return res;
     }
 
+    SPI_RX_BUF_RESET();
+    SPI_TX_BUF_RESET();
+    s_param_stage_pending = 0;
+
+#if NTS1_SPI_USE_DMA
+    s_spi_dma_init();
+#else
     HAL_NVIC_SetPriority(SPI_IRQn, SPI_IRQ_PRIORITY, 0);
     HAL_NVIC_EnableIRQ(SPI_IRQn);
 
     SPI_PERIPH->CR2 |= SPI_IT_RXNE;
-
-    s_panel_rx_status = 0;
-    s_panel_rx_data_cnt = 0;
-    SPI_RX_BUF_RESET();
-    SPI_TX_BUF_RESET();
+#endif
 
     __HAL_SPI_ENABLE(&s_spi);
 
@@ -297,269 +618,461 @@ HAL_StatusTypeDef s_spi_init() {
 
 HAL_StatusTypeDef s_spi_teardown() {
     __HAL_SPI_DISABLE(&s_spi);
+#if NTS1_SPI_USE_DMA
+    HAL_NVIC_DisableIRQ(SPI_DMA_IRQn);
+    SPI_DMA_RX_CH->CCR = 0;
+    SPI_DMA_TX_CH->CCR = 0;
+    SPI_PERIPH->CR2 &= ~(SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN);
+#endif
     SPI_CLK_DISABLE();
     return HAL_OK;
 }
 
 // ----------------------------------------------------
 
-static uint8_t s_tx_cmd_event(const nts1_tx_event_t* event, uint8_t endmark) {
+// Requests (descriptors, values) are bulk traffic, everything else is realtime
+static inline uint8_t s_tx_event_lane(uint8_t event_id) {
+    return (event_id >= k_nts1_tx_event_id_req_unit_count) ? k_nts1_tx_lane_bulk
+                                                           : k_nts1_tx_lane_realtime;
+}
+
+static uint8_t s_tx_cmd_event(const nts1_tx_event_t* event, uint8_t lane, uint8_t endmark) {
     assert(event != NULL);
-    if (!s_spi_chk_tx_buf_space(4)) return false;
-    const uint8_t cmd = (s_panel_id & PANEL_ID_MASK) + (endmark)
-                            ? (k_tx_cmd_event | PANEL_CMD_EMARK)
-                            : k_tx_cmd_event;
-    s_spi_tx_buf_write(cmd);
-    s_spi_tx_buf_write(event->event_id & 0x7F);
-    s_spi_tx_buf_write(event->msb & 0x7F);
-    s_spi_tx_buf_write(event->lsb & 0x7F);
-    return true;
+    const uint8_t cmd = (s_panel_id & PANEL_ID_MASK) +
+                      ((endmark) ? (k_tx_cmd_event | PANEL_CMD_EMARK) : k_tx_cmd_event);
+    const uint8_t data[] = {cmd, event->event_id & 0x7F, event->msb & 0x7F, event->lsb & 0x7F};
+    return s_spi_tx_buf_write(lane, data, sizeof(data));
 }
 
 static uint8_t s_tx_cmd_param_change(const nts1_tx_param_change_t* param_change, uint8_t endmark) {
     assert(param_change != NULL);
-    if (!s_spi_chk_tx_buf_space(4)) return false;
-    const uint8_t cmd = (s_panel_id & PANEL_ID_MASK) + (endmark)
-                            ? (k_tx_cmd_param | PANEL_CMD_EMARK)
-                            : k_tx_cmd_param;
-    s_spi_tx_buf_write(cmd);
-    s_spi_tx_buf_write(param_change->param_id & 0x7F);
-    s_spi_tx_buf_write(param_change->param_subid & 0x7F);
-    s_spi_tx_buf_write(param_change->msb & 0x7F);
-    s_spi_tx_buf_write(param_change->lsb & 0x7F);
+    const uint8_t cmd = (s_panel_id & PANEL_ID_MASK) +
+                      ((endmark) ? (k_tx_cmd_param | PANEL_CMD_EMARK) : k_tx_cmd_param);
+    const uint8_t data[] = {cmd, param_change->param_id & 0x7F, param_change->param_subid & 0x7F,
+                            param_change->msb & 0x7F, param_change->lsb & 0x7F};
+    if (!s_spi_tx_buf_write(k_nts1_tx_lane_realtime, data, sizeof(data))) {
+        return false;
+    }
+    nts1_param_change_queued(param_change);
     return true;
 }
 
 static uint8_t s_tx_cmd_other_ack(uint8_t endmark) {
-    if (!s_spi_chk_tx_buf_space(3)) return false;
-    const uint8_t cmd = (s_panel_id & PANEL_ID_MASK) + (endmark)
-                            ? (k_tx_cmd_other | PANEL_CMD_EMARK)
-                            : k_tx_cmd_other;
-    s_spi_tx_buf_write(cmd);
-    s_spi_tx_buf_write(3);
-    s_spi_tx_buf_write(k_tx_subcmd_other_ack);
-    return true;
+    const uint8_t cmd = (s_panel_id & PANEL_ID_MASK) +
+                      ((endmark) ? (k_tx_cmd_other | PANEL_CMD_EMARK) : k_tx_cmd_other);
+    const uint8_t data[] = {cmd, 3, k_tx_subcmd_other_ack};
+    return s_spi_tx_buf_write(k_nts1_tx_lane_realtime, data, sizeof(data));
 }
 
 static uint8_t s_tx_cmd_other_version(uint8_t endmark) {
-    if (!s_spi_chk_tx_buf_space(5)) return false;
-    const uint8_t cmd = (s_panel_id & PANEL_ID_MASK) + (endmark)
-                            ? (k_tx_cmd_other | PANEL_CMD_EMARK)
-                            : k_tx_cmd_other;
-    s_spi_tx_buf_write(cmd);
-    s_spi_tx_buf_write(5);
-    s_spi_tx_buf_write(k_tx_subcmd_other_version);
-    s_spi_tx_buf_write(1);
-    s_spi_tx_buf_write(0);
-    return true;
+    const uint8_t cmd = (s_panel_id & PANEL_ID_MASK) +
+                      ((endmark) ? (k_tx_cmd_other | PANEL_CMD_EMARK) : k_tx_cmd_other);
+    const uint8_t data[] = {cmd, 5, k_tx_subcmd_other_version, 1, 0};
+    return s_spi_tx_buf_write(k_nts1_tx_lane_realtime, data, sizeof(data));
 }
 
 static uint8_t s_tx_cmd_other_bootmode(uint8_t endmark) {
-    if (!s_spi_chk_tx_buf_space(4)) return false;
-    const uint8_t cmd = (s_panel_id & PANEL_ID_MASK) + (endmark)
-                            ? (k_tx_cmd_other | PANEL_CMD_EMARK)
-                            : k_tx_cmd_other;
-    s_spi_tx_buf_write(cmd);
-    s_spi_tx_buf_write(4);
-    s_spi_tx_buf_write(k_tx_subcmd_other_bootmode);
-    s_spi_tx_buf_write(0);
+    const uint8_t cmd = (s_panel_id & PANEL_ID_MASK) +
+                      ((endmark) ? (k_tx_cmd_other | PANEL_CMD_EMARK) : k_tx_cmd_other);
+    const uint8_t data[] = {cmd, 4, k_tx_subcmd_other_bootmode, 0};
+    return s_spi_tx_buf_write(k_nts1_tx_lane_realtime, data, sizeof(data));
+}
+
+// ----------------------------------------------------
+
+typedef char s_param_stage_size_check[(PARAM_STAGE_SIZE <= 32) ? 1 : -1];
+
+static uint8_t s_param_stage_find(uint8_t id, uint8_t subid) {
+    for (uint8_t i = 0; i < PARAM_STAGE_SIZE; ++i) {
+        if ((s_param_stage_pending & (1UL << i)) && s_param_stage[i].param_id == id &&
+            s_param_stage[i].param_subid == subid) {
+            return i;
+        }
+    }
+    return PARAM_STAGE_SIZE;
+}
+
+static uint8_t s_param_stage_put(uint8_t id, uint8_t subid, uint16_t value) {
+    uint8_t i = s_param_stage_find(id, subid);
+    if (i == PARAM_STAGE_SIZE) {
+        // new key, take a free slot
+        i = 0;
+        while (i < PARAM_STAGE_SIZE && (s_param_stage_pending & (1UL << i))) {
+            ++i;
+        }
+        if (i == PARAM_STAGE_SIZE) {
+            return false;
+        }
+        s_param_stage[i].param_id = id;
+        s_param_stage[i].param_subid = subid;
+        s_param_stage_pending |= 1UL << i;
+    }
+    // last writer wins
+    s_param_stage[i].msb = (value >> 7) & 0x7F;
+    s_param_stage[i].lsb = value & 0x7F;
     return true;
 }
 
+// A change sent directly supersedes a staged one for the same parameter
+static void s_param_stage_drop(uint8_t id, uint8_t subid) {
+    const uint8_t i = s_param_stage_find(id, subid);
+    if (i < PARAM_STAGE_SIZE) {
+        s_param_stage_pending &= ~(1UL << i);
+    }
+}
+
+static void s_param_stage_flush(void) {
+    for (uint8_t i = 0; s_param_stage_pending && i < PARAM_STAGE_SIZE; ++i) {
+        if (!(s_param_stage_pending & (1UL << i))) {
+            continue;
+        }
+        if (s_spi_tx_count(k_nts1_tx_lane_realtime) >= SPI_TX_PARAM_FLUSH_LEVEL ||
+            !s_tx_cmd_param_change(&s_param_stage[i], true)) {
+            break;
+        }
+        s_param_stage_pending &= ~(1UL << i);
+    }
+}
+
 // ----------------------------------------------------
 
-static uint8_t s_dummy_buffer[64];
-#define RX_EVENT_MAX_DECODE_SIZE 64
-static uint8_t s_rx_event_decode_buf[RX_EVENT_MAX_DECODE_SIZE] = {0};
+typedef char s_requests_size_check[(NTS1_MAX_PENDING_REQUESTS <= 32) ? 1 : -1];
 
-static void s_rx_msg_handler(uint8_t data) {
-    if (data >= 0x80) {
-        // Status byte
-        s_panel_rx_data_cnt = 0;
-        data &= ~PANEL_CMD_EMARK;
-        if (data == 0xBEU) {  // 10111110:Panel ID allocation
-            s_panel_rx_status = data & ~PANEL_ID_MASK;
-        } else if ((data & PANEL_ID_MASK) == (s_panel_id & PANEL_ID_MASK)) {
-            s_panel_rx_status = data & ~PANEL_ID_MASK;
-        } else {
-            s_panel_rx_status = 0;  // cancel any previous command reception
+// Called from nts1_idle() only. Slots are claimed from any context, so a slot is freed
+// with interrupts masked and its handler copied out first, the handler is then free to
+// send the next request.
+static void s_request_complete(uint8_t event_id, uint8_t main_id, uint8_t sub_id,
+                               const nts1_rx_reply_t* reply) {
+    if (!s_requests_pending) {
+        return;
+    }
+    s_request_t done = {NULL};
+    const uint32_t primask = s_spi_tx_lock();
+    for (uint8_t i = 0; i < NTS1_MAX_PENDING_REQUESTS; ++i) {
+        const s_request_t* req = &s_requests[i];
+        if ((s_requests_pending & (1UL << i)) && req->event_id == event_id &&
+            req->main_id == main_id && req->sub_id == sub_id) {
+            s_requests_pending &= ~(1UL << i);
+            done = *req;
+            break;
         }
+    }
+    s_spi_tx_unlock(primask);
+    if (done.handler != NULL) {
+        done.handler(k_nts1_status_ok, reply, done.context);
+    }
+}
+
+static void s_request_expire(void) {
+    if (!s_requests_pending) {
         return;
     }
+    const uint32_t now = getCurrentMicros();
+    for (uint8_t i = 0; i < NTS1_MAX_PENDING_REQUESTS; ++i) {
+        s_request_t done = {NULL};
+        const uint32_t primask = s_spi_tx_lock();
+        if ((s_requests_pending & (1UL << i)) &&
+            (int32_t)(now - s_requests[i].deadline) >= 0) {
+            s_requests_pending &= ~(1UL << i);
+            done = s_requests[i];
+        }
+        s_spi_tx_unlock(primask);
+        if (done.handler != NULL) {
+            done.handler(k_nts1_status_timeout, NULL, done.context);
+        }
+    }
+}
 
-    // Data byte
-    const uint8_t active_cmd = s_panel_rx_status;
+// ----------------------------------------------------
 
-    switch (active_cmd) {
-        case k_rx_cmd_event: {
-            s_panel_rx_data[s_panel_rx_data_cnt++] = data;
+#define RX_EVENT_MAX_DECODE_SIZE 64
+static uint8_t s_rx_event_decode_buf[RX_EVENT_MAX_DECODE_SIZE] = {0};
 
-            if (s_panel_rx_data_cnt < 2) break;  // need more data
+// Commands are parsed where they sit in the rx ring, nothing is copied out before a
+// command is complete. Reads go through spi_rx_ring_peek() so a command wrapping
+// around the end of the buffer needs no special case.
+#define RX_PEEK(offset) spi_rx_ring_peek(&s_spi_rx, (offset))
+
+// 7 bit payload at offset in the rx ring to 8 bit, writing at most size8 bytes
+static void s_rx_decode_7to8(uint8_t* dest8, uint32_t size8, uint16_t offset,
+                             uint32_t size7) {
+    // nts1_convert_7to8() writes one byte past nts1_size_7to8()
+    const uint16_t at = (uint16_t)(s_spi_rx.ridx + offset) & SPI_RX_BUF_MASK;
+    if (at + size7 <= SPI_RX_BUF_SIZE && nts1_size_7to8(size7) < size8) {
+        nts1_convert_7to8(dest8, &s_spi_rx.buf[at], size7);
+        return;
+    }
 
-            if (s_panel_rx_data_cnt < (s_panel_rx_data[0] - 1)) break;  // need more data
+    // wraps around the end of the ring, or the destination is too tight
+    uint32_t i8 = 0;
+    for (uint32_t i7 = 0; i7 < size7; ++i7) {
+        const uint8_t i7mod8 = i7 & 0x7;
+        const uint8_t src = RX_PEEK(offset + i7) & 0x7F;
+        if (i7mod8 == 0) {
+            if (i8 == size8) break;
+            dest8[i8++] = src;
+            continue;
+        }
+        dest8[i8 - 1] |= (uint8_t)(src << (8 - i7mod8));
+        if (i7mod8 != 7) {
+            if (i8 == size8) break;
+            dest8[i8++] = src >> i7mod8;
+        }
+    }
+}
 
-            /*++++++++++++++++++++++++++++++++++++++++++++++
-              CMD4 : Event
-              1st    :[1][0][ppp][100]
-              2nd    :[0][sssssss] Size
-              3rd    :[0][eeeeeee] Event ID
-              4th    :[0][ddddddd] Data word
-              ...
-              +++++++++++++++++++++++++++++++++++++++++++++*/
+// Length of the command starting with status at the head of the ring, 0 if not known yet
+static uint16_t s_rx_cmd_length(uint8_t cmd, uint16_t count) {
+    switch (cmd) {
+        case k_rx_cmd_event:
+            if (count < 2) return 0;
+            // status, size, event id at least
+            return (RX_PEEK(1) < 3) ? 3 : RX_PEEK(1);
+        case k_rx_cmd_param:
+            return 5;
+        case k_rx_cmd_other:
+            if (count < 2) return 0;
+            // too short to hold a subcommand, dropped along with the size byte
+            return (RX_PEEK(1) < 3) ? 2 : RX_PEEK(1);
+        case k_rx_cmd_dummy:
+        default:
+            return 1;
+    }
+}
 
-            const nts1_rx_event_header_t* rx_event = (const nts1_rx_event_header_t*)s_panel_rx_data;
-            const uint8_t* payload = s_panel_rx_data + sizeof(nts1_rx_event_header_t);
+static void s_rx_event(void) {
+    /*++++++++++++++++++++++++++++++++++++++++++++++
+      CMD4 : Event
+      1st    :[1][0][ppp][100]
+      2nd    :[0][sssssss] Size
+      3rd    :[0][eeeeeee] Event ID
+      4th    :[0][ddddddd] Data word
+      ...
+      +++++++++++++++++++++++++++++++++++++++++++++*/
+    const uint8_t size = RX_PEEK(1);
+    const uint8_t event_id = RX_PEEK(2);
+    const uint16_t payload = 1 + sizeof(nts1_rx_event_header_t);
+
+    const uint32_t payload_size7 = (size - sizeof(nts1_rx_event_header_t) - 1);
+    const uint32_t payload_size8 = nts1_size_7to8(payload_size7);
+    if (payload_size8 > RX_EVENT_MAX_DECODE_SIZE) {
+        ++s_link_stats.rx_rejected_frames;
+        return;
+    }
 
-            const uint32_t payload_size7 = (rx_event->size - sizeof(nts1_rx_event_header_t) - 1);
-            const uint32_t payload_size8 = nts1_size_7to8(payload_size7);
-            if (payload_size8 > RX_EVENT_MAX_DECODE_SIZE) {
-                // Reset rx status
-                s_panel_rx_status = 0;
-                s_panel_rx_data_cnt = 0;
-                break;
+    // Small fixed size events are decoded from the ring straight into their struct
+    union {
+        nts1_rx_note_off_t note_off;
+        nts1_rx_note_on_t note_on;
+        nts1_rx_value_t value;
+        uint8_t raw[sizeof(nts1_rx_value_t) + 1];  // room for the decoder's extra byte
+    } small;
+
+    switch (event_id) {
+        case k_nts1_rx_event_id_note_off:
+            if (payload_size8 == sizeof(nts1_rx_note_off_t)) {
+                s_rx_decode_7to8(small.raw, sizeof(small), payload, payload_size7);
+                nts1_handle_note_off_event(&small.note_off);
             }
-            nts1_convert_7to8(s_rx_event_decode_buf, payload, payload_size7);
-
-            switch (rx_event->event_id) {
-                case k_nts1_rx_event_id_note_off:
-                    if (payload_size8 == sizeof(nts1_rx_note_off_t))
-                        nts1_handle_note_off_event(
-                            (const nts1_rx_note_off_t*)s_rx_event_decode_buf);
-                    break;
-                case k_nts1_rx_event_id_note_on:
-                    if (payload_size8 == sizeof(nts1_rx_note_on_t))
-                        nts1_handle_note_on_event((const nts1_rx_note_on_t*)s_rx_event_decode_buf);
-                    break;
-                case k_nts1_rx_event_id_step_tick:
-                    nts1_handle_step_tick_event();
-                    break;
-                case k_nts1_rx_event_id_unit_desc:
-                    // if (payload_size8 == sizeof(nts1_rx_unit_desc_t))
-                    nts1_handle_unit_desc_event((const nts1_rx_unit_desc_t*)s_rx_event_decode_buf);
-                    break;
-                case k_nts1_rx_event_id_edit_param_desc:
-                    if (payload_size8 == sizeof(nts1_rx_edit_param_desc_t)) {
-                        nts1_handle_edit_param_desc_event(
-                            (const nts1_rx_edit_param_desc_t*)s_rx_event_decode_buf);
-                    }
-                    break;
-                case k_nts1_rx_event_id_value:
-                    if (payload_size8 == sizeof(nts1_rx_value_t))
-                        nts1_handle_value_event((const nts1_rx_value_t*)s_rx_event_decode_buf);
-                    break;
-                default:
-                    break;
+            break;
+        case k_nts1_rx_event_id_note_on:
+            if (payload_size8 == sizeof(nts1_rx_note_on_t)) {
+                s_rx_decode_7to8(small.raw, sizeof(small), payload, payload_size7);
+                nts1_handle_note_on_event(&small.note_on);
             }
+            break;
+        case k_nts1_rx_event_id_step_tick:
+            nts1_handle_step_tick_event();
+            break;
+        case k_nts1_rx_event_id_unit_desc:
+            // if (payload_size8 == sizeof(nts1_rx_unit_desc_t))
+            s_rx_decode_7to8(s_rx_event_decode_buf, RX_EVENT_MAX_DECODE_SIZE, payload,
+                             payload_size7);
+            {
+                const nts1_rx_unit_desc_t* unit_desc =
+                    (const nts1_rx_unit_desc_t*)s_rx_event_decode_buf;
+                nts1_handle_unit_desc_event(unit_desc);
+                s_request_complete(k_nts1_tx_event_id_req_unit_desc, unit_desc->main_id,
+                                   unit_desc->sub_id, (const nts1_rx_reply_t*)unit_desc);
+            }
+            break;
+        case k_nts1_rx_event_id_edit_param_desc:
+            if (payload_size8 == sizeof(nts1_rx_edit_param_desc_t)) {
+                s_rx_decode_7to8(s_rx_event_decode_buf, RX_EVENT_MAX_DECODE_SIZE, payload,
+                                 payload_size7);
+                const nts1_rx_edit_param_desc_t* param_desc =
+                    (const nts1_rx_edit_param_desc_t*)s_rx_event_decode_buf;
+                nts1_handle_edit_param_desc_event(param_desc);
+                s_request_complete(k_nts1_tx_event_id_req_edit_param_desc, param_desc->main_id,
+                                   param_desc->sub_id, (const nts1_rx_reply_t*)param_desc);
+            }
+            break;
+        case k_nts1_rx_event_id_value:
+            if (payload_size8 == sizeof(nts1_rx_value_t)) {
+                s_rx_decode_7to8(small.raw, sizeof(small), payload, payload_size7);
+                nts1_handle_value_event(&small.value);
+                // req_id tells value and unit count replies apart
+                s_request_complete(small.value.req_id, small.value.main_id, small.value.sub_id,
+                                   (const nts1_rx_reply_t*)&small.value);
+            }
+            break;
+        default:
+            break;
+    }
+}
 
-            // Reset rx status
-            s_panel_rx_status = 0;
-            s_panel_rx_data_cnt = 0;
-        } break;
+static void s_rx_param(void) {
+    /*++++++++++++++++++++++++++++++++++++++++++++++
+      CMD5 : Param Change
+      1st    :[1][0][ppp][101]
+      2nd    :[0][eeeeeee] Param ID
+      3rd    :[0][sssssss] Param Sub ID
+      4th    :[0][hhhhhhh] MSB
+      5th    :[0][lllllll] LSB
+      +++++++++++++++++++++++++++++++++++++++++++++*/
+    const uint16_t at = (uint16_t)(s_spi_rx.ridx + 1) & SPI_RX_BUF_MASK;
+    if (at + sizeof(nts1_rx_param_change_t) <= SPI_RX_BUF_SIZE) {
+        // all bytes, no packing, handed over right where they are in the ring
+        nts1_handle_param_change((const nts1_rx_param_change_t*)&s_spi_rx.buf[at]);
+        return;
+    }
+    // wraps around the end of the ring
+    const nts1_rx_param_change_t rx_param = {RX_PEEK(1), RX_PEEK(2), RX_PEEK(3), RX_PEEK(4)};
+    nts1_handle_param_change(&rx_param);
+}
 
-        case k_rx_cmd_param: {
-            s_panel_rx_data[s_panel_rx_data_cnt++] = data;
+static void s_rx_other(uint8_t size) {
+    switch (RX_PEEK(2)) {
+        case k_rx_subcmd_other_panelid:  // Panel
+                                         // ID指定（"ppp"は残しているのここにはこない）
+            /*++++++++++++++++++++++++++++++++++++++++++++++
+              CMD6-0 :PanelID指定。
+              このケースのみ、ppp=7を指定する。
+              1st    :[1][0][111][110] ppp=7使用
+              2nd    :[0][0000100] Size=4
+              3rd    :[0][0000000] MessageID = 0
+              4th    :[0][0000PPP] 指定するPanelID番号。
+              +++++++++++++++++++++++++++++++++++++++++++++*/
+            if (size == 4) {
+                s_panel_id = ((RX_PEEK(3) & 0x07) << 3) & PANEL_ID_MASK;
+                s_dummy_tx_cmd = s_panel_id | 0xC7;  // B'11ppp111;
+                // VersionをHOSTへ送信
+                s_tx_cmd_other_version(false);
+                // All SW PatternをHOSTへ送信
+                s_tx_cmd_other_bootmode(true);
+            }
+            break;
 
-            if (s_panel_rx_data_cnt < 4) break;  // need more data
+        case k_rx_subcmd_other_stsreq:
+            /*++++++++++++++++++++++++++++++++++++++++++++++
+              CMD6-1 :Status Request
+              現在のSwitchPattern(CMD6-17)と、全ノブコマンドの送付要求。
+              1st    :[1][0][ppp][110]
+              2nd    :[0][0000011] Size=3
+              3rd    :[0][0000001] MessageID = 1
+              +++++++++++++++++++++++++++++++++++++++++++++*/
+            s_tx_cmd_other_bootmode(true);
+            break;
 
+        case k_rx_subcmd_other_ackreq:  // Panel ACK req
             /*++++++++++++++++++++++++++++++++++++++++++++++
-              CMD5 : Param Change
-              1st    :[1][0][ppp][101]
-              2nd    :[0][eeeeeee] Param ID
-              3rd    :[0][sssssss] Param Sub ID
-              4th    :[0][hhhhhhh] MSB
-              5th    :[0][lllllll] LSB
+              CMD6-3 :ACK request
+              Panelが正常動作しているかどうかの検査用。
+              Panelはこれを受けたらACKコマンドを返送する。
+              1st    :[1][0][ppp][110]
+              2nd    :[0][0000011] Size=3
+              3rd    :[0][0000011] MessageID = 3
               +++++++++++++++++++++++++++++++++++++++++++++*/
+            s_tx_cmd_other_ack(true);
+            break;
+
+        default:
+            // Undefined command - ignore
+            break;
+    }
+}
+
+// Handle complete commands in the rx ring until it runs dry or the idle budget is spent.
+// A command is consumed only once all of its bytes have arrived, an incomplete one is
+// left for the next call. The budget is checked between commands once something has been
+// consumed, so every call makes progress. Returns the number of bytes consumed.
+static uint16_t s_rx_parse(uint32_t start) {
+    const uint16_t budget_bytes = s_idle_stats.budget_bytes;
+    const uint16_t budget_us = s_idle_stats.budget_us;
+    uint16_t parsed = 0;
+    uint16_t count;
+    while ((count = spi_rx_ring_count(&s_spi_rx)) != 0) {
+        if (parsed != 0 && ((budget_bytes != 0 && parsed >= budget_bytes) ||
+                            (budget_us != 0 && getCurrentMicros() - start >= budget_us))) {
+            ++s_idle_stats.budget_stops;
+            break;
+        }
 
-            const nts1_rx_param_change_t* rx_param = (const nts1_rx_param_change_t*)s_panel_rx_data;
-            nts1_handle_param_change(rx_param);
+        uint8_t status = RX_PEEK(0);
+        if (status < 0x80) {
+            // data byte outside of a command, skip up to the next status byte
+            spi_rx_ring_consume(&s_spi_rx, 1);
+            ++parsed;
+            continue;
+        }
 
-            // Reset rx status
-            s_panel_rx_status = 0;
-            s_panel_rx_data_cnt = 0;
-        } break;
+        status &= ~PANEL_CMD_EMARK;
+        uint8_t cmd = 0;
+        if (status == 0xBEU) {  // 10111110:Panel ID allocation
+            cmd = status & ~PANEL_ID_MASK;
+        } else if ((status & PANEL_ID_MASK) == (s_panel_id & PANEL_ID_MASK)) {
+            cmd = status & ~PANEL_ID_MASK;
+        }
 
-        case k_rx_cmd_other: {
-            s_panel_rx_data[s_panel_rx_data_cnt++] = data;
-            if (s_panel_rx_data_cnt < (s_panel_rx_data[0] - 1)) break;  // need more data
+        const uint16_t length = s_rx_cmd_length(cmd, count);
+        if (length == 0) {
+            break;  // need more data
+        }
 
-            if (s_panel_rx_data_cnt < 2) {
-                // Command too short - ignore and reset
-                s_panel_rx_status = 0;
-                s_panel_rx_data_cnt = 0;
+        // A status byte before the end cuts the command short, resync on it
+        const uint16_t avail = (count < length) ? count : length;
+        uint16_t resync = 0;
+        for (uint16_t i = 1; i < avail; ++i) {
+            if (RX_PEEK(i) >= 0x80) {
+                resync = i;
                 break;
             }
+        }
+        if (resync) {
+            ++s_link_stats.rx_dropped_frames;
+            spi_rx_ring_consume(&s_spi_rx, resync);
+            parsed += resync;
+            continue;
+        }
+        if (count < length) {
+            break;  // need more data
+        }
 
-            switch (s_panel_rx_data[1]) {
-                case k_rx_subcmd_other_panelid:  // Panel
-                                                 // ID指定（"ppp"は残しているのここにはこない）
-                    /*++++++++++++++++++++++++++++++++++++++++++++++
-                      CMD6-0 :PanelID指定。
-                      このケースのみ、ppp=7を指定する。
-                      1st    :[1][0][111][110] ppp=7使用
-                      2nd    :[0][0000100] Size=4
-                      3rd    :[0][0000000] MessageID = 0
-                      4th    :[0][0000PPP] 指定するPanelID番号。
-                      +++++++++++++++++++++++++++++++++++++++++++++*/
-                    if (s_panel_rx_data_cnt >= 3 && s_panel_rx_data[0] == 4) {
-                        s_panel_id = ((s_panel_rx_data[2] & 0x07) << 3) & PANEL_ID_MASK;
-                        s_dummy_tx_cmd = s_panel_id | 0xC7;  // B'11ppp111;
-                        // VersionをHOSTへ送信
-                        s_tx_cmd_other_version(false);
-                        // All SW PatternをHOSTへ送信
-                        s_tx_cmd_other_bootmode(true);
-                    }
-                    // Reset rx status
-                    s_panel_rx_status = 0;
-                    s_panel_rx_data_cnt = 0;
-                    break;
-
-                case k_rx_subcmd_other_stsreq:
-                    /*++++++++++++++++++++++++++++++++++++++++++++++
-                      CMD6-1 :Status Request
-                      現在のSwitchPattern(CMD6-17)と、全ノブコマンドの送付要求。
-                      1st    :[1][0][ppp][110]
-                      2nd    :[0][0000011] Size=3
-                      3rd    :[0][0000001] MessageID = 1
-                      +++++++++++++++++++++++++++++++++++++++++++++*/
-                    s_tx_cmd_other_bootmode(true);
-                    // Reset rx status
-                    s_panel_rx_status = 0;
-                    s_panel_rx_data_cnt = 0;
-                    break;
-
-                case k_rx_subcmd_other_ackreq:  // Panel ACK req
-                    /*++++++++++++++++++++++++++++++++++++++++++++++
-                      CMD6-3 :ACK request
-                      Panelが正常動作しているかどうかの検査用。
-                      Panelはこれを受けたらACKコマンドを返送する。
-                      1st    :[1][0][ppp][110]
-                      2nd    :[0][0000011] Size=3
-                      3rd    :[0][0000011] MessageID = 3
-                      +++++++++++++++++++++++++++++++++++++++++++++*/
-                    s_tx_cmd_other_ack(true);
-                    // Reset rx status
-                    s_panel_rx_status = 0;
-                    s_panel_rx_data_cnt = 0;
-                    break;
-
-                default:
-                    // Undefined command - ignore and reset
-                    s_panel_rx_status = 0;
-                    s_panel_rx_data_cnt = 0;
-                    break;
-            }
-        }  // end case k_rx_cmd_other:
-        break;
-        case k_rx_cmd_dummy:
-        default:
-            s_panel_rx_status = 0;    // 保存ステータスをクリア
-            s_panel_rx_data_cnt = 0;  // データカウントを初期化
-            break;
+        switch (cmd) {
+            case k_rx_cmd_event:
+                s_rx_event();
+                break;
+            case k_rx_cmd_param:
+                s_rx_param();
+                break;
+            case k_rx_cmd_other:
+                if (length >= 3) {
+                    s_rx_other(RX_PEEK(1));
+                }
+                break;
+            default:
+                break;
+        }
+        spi_rx_ring_consume(&s_spi_rx, length);
+        parsed += length;
     }
+    return parsed;
 }
 
 // ----------------------------------------------------
 
+#if !NTS1_SPI_USE_DMA
+
 extern void SPI_IRQ_HANDLER() {
     volatile uint16_t sr;
     uint8_t txdata, rxdata;
@@ -586,36 +1099,44 @@ extern void SPI_IRQ_HANDLER() {
         //*/
         //} else { // if (rxdata & ~(PANEL_ID_MASK | PANEL_CMD_EMARK)) != 0x87) {
         if (!s_spi_rx_buf_write(rxdata)) {
-            // RxBuf が一杯の時は、リセットする。
-            SPI_RX_BUF_RESET();
+            // RxBuf is full, drop the byte. Resetting it here would write the consumer's
+            // index, the parser resyncs on the next status byte instead.
         } else {
-            if (!s_spi_chk_rx_buf_space(32)) {
-                s_port_wait_ack();
-            } else {  // バッファー残が復旧
-                s_port_startup_ack();
-            }
+            s_port_update_ack(spi_rx_ring_count(&s_spi_rx));
         }
         //}
     }
 
     // HOST <- PANEL 送信部
-    if (!SPI_TX_BUF_EMPTY()) {  // 送信Bufferにデータあり
-        txdata = s_spi_tx_buf_read();
-        if (txdata & 0x80) {  // Statusの時は、EndMarkを付加するかチェックする。
-            if (!SPI_TX_BUF_EMPTY()) {  // 送信Bufferに次に送信するデータあり
-                txdata |= PANEL_CMD_EMARK;
-                // Note: this will set endmark on almost any status, especially those who have
-                // pending data,
-                //       which seems to contradict the endmark common usage of marking only the last
-                //       command of a group
-            }
-        }
-        s_spi_raw_fifo_push8(SPI_PERIPH, txdata);
-    } else {  // 送信バッファーが空なのでダミーをセットする。
-        s_spi_raw_fifo_push8(SPI_PERIPH, s_dummy_tx_cmd);
+    txdata = s_spi_tx_next();
+    s_spi_raw_fifo_push8(SPI_PERIPH, txdata);
+}
+
+#else
+
+extern void SPI_DMA_IRQ_HANDLER() {
+    const uint32_t isr = DMA1->ISR;
+
+    // HOST -> PANEL: half of the rx buffer was written, ask the host to wait if the next
+    // half may not fit
+    if (isr & SPI_DMA_RX_FLAGS) {
+        DMA1->IFCR = isr & SPI_DMA_RX_FLAGS;
+        s_port_update_ack(s_spi_rx_dma_count());
+    }
+
+    // HOST <- PANEL: refill the half that was just sent
+    if (isr & DMA_ISR_HTIF5) {
+        DMA1->IFCR = DMA_ISR_HTIF5;
+        s_spi_tx_dma_fill(s_spi_tx_dma_buf);
+    }
+    if (isr & DMA_ISR_TCIF5) {
+        DMA1->IFCR = DMA_ISR_TCIF5;
+        s_spi_tx_dma_fill(s_spi_tx_dma_buf + SPI_TX_DMA_HALF_SIZE);
     }
 }
 
+#endif
+
 // ----------------------------------------------------
 
 nts1_status_t nts1_init() {
@@ -634,13 +1155,16 @@ nts1_status_t nts1_init() {
     HAL_StatusTypeDef res = s_spi_init();
     if (res != HAL_OK) return (nts1_status_t)res;
 
+#if !NTS1_SPI_USE_DMA
     // Fill TX FIFO
     s_spi_raw_fifo_push8(SPI_PERIPH, s_dummy_tx_cmd);
     s_spi_raw_fifo_push8(SPI_PERIPH, s_dummy_tx_cmd);
     s_spi_raw_fifo_push8(SPI_PERIPH, s_dummy_tx_cmd);
     s_spi_raw_fifo_push8(SPI_PERIPH, s_dummy_tx_cmd);
     //*/
+#endif
 
+    s_requests_pending = 0;
     s_port_startup_ack();
     s_started = true;
 
@@ -654,98 +1178,291 @@ nts1_status_t nts1_teardown() {
 }
 
 nts1_status_t nts1_idle() {
-    // HOST通信の復帰Check
+#if NTS1_SPI_USE_DMA
+    s_spi_rx_dma_sync();
+#endif
+
+    // HOST I/F受信データのIdle処理を優先する
+    // Not from a handler called by the parser, it still owns the command and the decode
+    // buffer. The rest is safe to run nested.
+    nts1_status_t status = k_nts1_status_ok;
+    if (!s_rx_parsing) {
+        s_rx_parsing = true;
+        const uint32_t start = getCurrentMicros();
+        const uint16_t parsed = s_rx_parse(start);
+        const uint32_t elapsed = getCurrentMicros() - start;
+        s_rx_parsing = false;
+
+        nts1_idle_stats_t* stats = &s_idle_stats;
+        stats->last_bytes = parsed;
+        stats->last_us = (elapsed < 0xFFFFU) ? elapsed : 0xFFFFU;
+        if (stats->last_us > stats->max_us) {
+            stats->max_us = stats->last_us;
+        }
+        stats->backlog = spi_rx_ring_count(&s_spi_rx);
+        if (stats->backlog > stats->max_backlog) {
+            stats->max_backlog = stats->backlog;
+        }
+    } else {
+        ++s_idle_stats.reentries;
+        status = k_nts1_status_busy;
+    }
+
+    // HOST通信の復帰Check, once parsing has made room
     if (s_started) {
-        if (s_spi_chk_rx_buf_space(32)) {
+        const uint32_t primask = s_spi_tx_lock();
+        if (!s_ack_hold && spi_rx_ring_count(&s_spi_rx) <= s_rx_ack_low) {
             s_port_startup_ack();
         }
+        s_spi_tx_unlock(primask);
     }
 
-    // HOST I/F受信データのIdle処理を優先する
-    /* for (uint8_t cnt = 0; cnt < 32; cnt++) { */
-    /*   if (SPI_RX_BUF_EMPTY()) */
-    /*     break; */
-    while (!SPI_RX_BUF_EMPTY()) {
-        // 受信Bufferにデータあり
-        s_rx_msg_handler(s_spi_rx_buf_read());
-    }
+    // move staged parameter changes along as the tx buffer drains
+    const uint32_t primask = s_spi_tx_lock();
+    s_param_stage_flush();
+    s_spi_tx_unlock(primask);
+
+    // requests whose reply did not arrive in time, after parsing had its chance
+    s_request_expire();
+
+    return status;
+}
+
+nts1_status_t nts1_set_idle_budget(uint16_t max_bytes, uint16_t max_us) {
+    s_idle_stats.budget_bytes = max_bytes;
+    s_idle_stats.budget_us = max_us;
+    return k_nts1_status_ok;
+}
+
+void nts1_get_idle_stats(nts1_idle_stats_t* stats) {
+    assert(stats != NULL);
+    *stats = s_idle_stats;
+}
+
+void nts1_reset_idle_stats(void) {
+    nts1_idle_stats_t* stats = &s_idle_stats;
+    stats->last_bytes = stats->last_us = stats->max_us = 0;
+    stats->backlog = stats->max_backlog = 0;
+    stats->budget_stops = stats->reentries = 0;
 }
 
 // ----------------------------------------------------
 
 nts1_status_t nts1_send_events(nts1_tx_event_t* events, uint8_t count) {
     assert(events != NULL);
+    // status + 3 data bytes per event on its lane, all of them or none, under one lock
+    uint16_t bulk_size = 0;
     for (uint8_t i = 0; i < count; ++i) {
-        if (!s_tx_cmd_event(&events[i], (i == count - 1))) {
-            return k_nts1_status_busy;
-        }
+        bulk_size += (s_tx_event_lane(events[i].event_id) == k_nts1_tx_lane_bulk) ? 4 : 0;
     }
+    const uint32_t primask = s_spi_tx_lock();
+    if (!s_spi_chk_tx_buf_space(k_nts1_tx_lane_realtime, 4 * count - bulk_size) ||
+        !s_spi_chk_tx_buf_space(k_nts1_tx_lane_bulk, bulk_size)) {
+        s_link_stats.tx_dropped_frames += count;
+        s_spi_tx_unlock(primask);
+        return k_nts1_status_busy;
+    }
+    for (uint8_t i = 0; i < count; ++i) {
+        s_tx_cmd_event(&events[i], s_tx_event_lane(events[i].event_id), (i == count - 1));
+    }
+    s_spi_tx_unlock(primask);
     return k_nts1_status_ok;
 }
 
 nts1_status_t nts1_send_param_changes(nts1_tx_param_change_t* param_changes, uint8_t count) {
     assert(param_changes != NULL);
+    const uint32_t primask = s_spi_tx_lock();
     for (uint8_t i = 0; i < count; ++i) {
         if (!s_tx_cmd_param_change(&param_changes[i], (i == count - 1))) {
+            s_spi_tx_unlock(primask);
             return k_nts1_status_busy;
         }
+        s_param_stage_drop(param_changes[i].param_id, param_changes[i].param_subid);
     }
+    s_spi_tx_unlock(primask);
     return k_nts1_status_ok;
 }
 
-uint32_t nts1_convert_7to8(uint8_t* dest8, const uint8_t* src7, uint32_t size7) {
-    const uint32_t size8 = nts1_size_7to8(size7);
-    const uint8_t* src7_e = src7 + size7;
-    for (uint32_t i7 = 0, i8 = 0; i7 < size7; ++i7) {
-        const uint8_t i7mod8 = i7 % 8;
-        switch (i7mod8) {
-            case 0:
-                dest8[i8++] = src7[i7] & 0x7F;
-                break;
-            case 7:
-                dest8[i8 - 1] |= (src7[i7] & 0x7F) << 1;
-                break;
-            default: {
-                const uint8_t offset = 8 - i7mod8;
-                const uint8_t src = src7[i7];
-                dest8[i8 - 1] |= (src & ((1U << i7mod8) - 1)) << offset;
-                dest8[i8++] = (src & 0x7F) >> i7mod8;
-            } break;
-        }
+nts1_status_t nts1_send_frame(const nts1_tx_param_change_t* param_changes, uint8_t param_count,
+                              const nts1_tx_event_t* events, uint8_t event_count) {
+    assert(param_changes != NULL || param_count == 0);
+    assert(events != NULL || event_count == 0);
+    // status + 4 data bytes per param change, status + 3 data bytes per event, nothing
+    // else may be queued between the check and the last command
+    const uint32_t primask = s_spi_tx_lock();
+    if (!s_spi_chk_tx_buf_space(k_nts1_tx_lane_realtime, 5 * param_count + 4 * event_count)) {
+        s_link_stats.tx_dropped_frames += param_count + event_count;
+        s_spi_tx_unlock(primask);
+        return k_nts1_status_busy;
+    }
+    for (uint8_t i = 0; i < param_count; ++i) {
+        s_tx_cmd_param_change(&param_changes[i], (event_count == 0 && i == param_count - 1));
+        s_param_stage_drop(param_changes[i].param_id, param_changes[i].param_subid);
+    }
+    for (uint8_t i = 0; i < event_count; ++i) {
+        // the whole frame is realtime, whatever its events
+        s_tx_cmd_event(&events[i], k_nts1_tx_lane_realtime, (i == event_count - 1));
     }
-    return size8;
+    s_spi_tx_unlock(primask);
+    return k_nts1_status_ok;
 }
 
-uint32_t nts1_convert_8to7(uint8_t* dest7, const uint8_t* src8, uint32_t size8) {
-    const uint32_t size7 = nts1_size_8to7(size8);
-    const uint8_t* dest7_e = dest7 + size7;
-    for (uint32_t i7 = 0, i8 = 0; i7 < size7; ++i7) {
-        const uint8_t i7mod8 = i7 % 8;
-        switch (i7mod8) {
-            case 0:
-                dest7[i7] = src8[i8++] & 0x7F;
-                break;
-            case 7:
-                dest7[i7] = (src8[i8 - 1] & (0x7F << 1)) >> 1;
-                break;
-            default: {
-                const uint8_t offset = 8 - i7mod8;
-                uint8_t dest = (src8[i8 - 1] & (0xFFU << offset)) >> offset;
-                dest |= (src8[i8++] & (0x7F >> i7mod8)) << i7mod8;
-                dest7[i7] = dest;
-            } break;
-        }
+nts1_status_t nts1_request(uint8_t event_id, uint8_t main_id, uint8_t sub_id,
+                           uint32_t timeout_us, nts1_reply_handler handler, void* context) {
+    assert(handler != NULL && event_id >= k_nts1_tx_event_id_req_unit_count);
+    const uint32_t primask = s_spi_tx_lock();
+    uint8_t i = 0;
+    while (i < NTS1_MAX_PENDING_REQUESTS && (s_requests_pending & (1UL << i))) {
+        ++i;
     }
-    return size7;
+    if (i == NTS1_MAX_PENDING_REQUESTS) {
+        s_spi_tx_unlock(primask);
+        return k_nts1_status_busy;
+    }
+    // matched against the reply as sent, 7 bit
+    const nts1_tx_event_t event = {event_id & 0x7F, main_id & 0x7F, sub_id & 0x7F};
+    if (!s_tx_cmd_event(&event, k_nts1_tx_lane_bulk, true)) {
+        s_spi_tx_unlock(primask);
+        return k_nts1_status_busy;
+    }
+    s_request_t* req = &s_requests[i];
+    req->handler = handler;
+    req->context = context;
+    req->deadline = getCurrentMicros() + timeout_us;
+    req->event_id = event.event_id;
+    req->main_id = event.msb;
+    req->sub_id = event.lsb;
+    s_requests_pending |= 1UL << i;
+    s_spi_tx_unlock(primask);
+    return k_nts1_status_ok;
 }
 
+uint8_t nts1_pending_request_count(void) {
+    uint8_t count = 0;
+    for (uint32_t pending = s_requests_pending; pending; pending &= pending - 1) {
+        ++count;
+    }
+    return count;
+}
+
+void nts1_get_tx_lane_stats(uint8_t lane, nts1_tx_lane_stats_t* stats) {
+    assert(lane < k_nts1_num_tx_lanes && stats != NULL);
+    const uint32_t primask = s_spi_tx_lock();
+    *stats = s_tx_lane_stats[lane];
+    stats->depth = s_spi_tx_count(lane);
+    s_spi_tx_unlock(primask);
+}
+
+void nts1_reset_tx_lane_stats(void) {
+    const uint32_t primask = s_spi_tx_lock();
+    for (uint8_t i = 0; i < k_nts1_num_tx_lanes; ++i) {
+        const nts1_tx_lane_stats_t zero = {0};
+        s_tx_lane_stats[i] = zero;
+    }
+    s_spi_tx_unlock(primask);
+}
+
+nts1_status_t nts1_set_rx_ack_watermarks(uint16_t high, uint16_t low) {
+    if (low >= high || high < RX_CMD_MAX_SIZE || high > SPI_RX_ACK_HIGH_MAX) {
+        return k_nts1_status_error;
+    }
+    const uint32_t primask = s_spi_tx_lock();
+    s_rx_ack_high = high;
+    s_rx_ack_low = low;
+    s_spi_tx_unlock(primask);
+    return k_nts1_status_ok;
+}
+
+// Moves with every byte clocked by the main board
+static uint32_t s_spi_rx_position(void) {
+#if NTS1_SPI_USE_DMA
+    return SPI_DMA_RX_CH->CNDTR;
+#else
+    return s_link_stats.rx_bytes;
+#endif
+}
+
+void nts1_hold_main_board(uint8_t hold) {
+    const uint32_t primask = s_spi_tx_lock();
+    s_ack_hold = hold;
+    if (hold) {
+        s_port_wait_ack();
+        s_hold_rx_pos = s_spi_rx_position();
+        s_hold_rx_stamp = getCurrentMicros();
+    } else {
+        s_port_update_ack(spi_rx_ring_count(&s_spi_rx));
+    }
+    s_spi_tx_unlock(primask);
+}
+
+uint8_t nts1_main_board_quiet(void) {
+    if (!s_ack_hold) {
+        return false;
+    }
+    const uint32_t pos = s_spi_rx_position();
+    const uint32_t now = getCurrentMicros();
+    if (pos != s_hold_rx_pos) {
+        s_hold_rx_pos = pos;
+        s_hold_rx_stamp = now;
+        return false;
+    }
+    return now - s_hold_rx_stamp >= NTS1_HOLD_QUIET_US;
+}
+
+void nts1_get_link_stats(nts1_link_stats_t* stats) {
+    assert(stats != NULL);
+    const uint32_t primask = s_spi_tx_lock();
+    *stats = s_link_stats;
+    if (s_ack_waiting) {
+        // still waiting, count the time so far
+        stats->ack_wait_us += getCurrentMicros() - s_ack_wait_stamp;
+    }
+    s_spi_tx_unlock(primask);
+}
+
+void nts1_reset_link_stats(void) {
+    const uint32_t primask = s_spi_tx_lock();
+    const nts1_link_stats_t zero = {0};
+    s_link_stats = zero;
+    s_ack_wait_stamp = getCurrentMicros();
+    s_spi_tx_unlock(primask);
+}
+
+uint32_t nts1_tx_lock(void) { return s_spi_tx_lock(); }
+
+void nts1_tx_unlock(uint32_t primask) { s_spi_tx_unlock(primask); }
+
+uint8_t nts1_param_staged(uint8_t id, uint8_t subid) {
+    const uint32_t primask = s_spi_tx_lock();
+    const uint8_t staged = s_param_stage_find(id, subid) < PARAM_STAGE_SIZE;
+    s_spi_tx_unlock(primask);
+    return staged;
+}
+
+// ----------------------------------------------------
+
+uint32_t nts1_convert_7to8(uint8_t* dest8, const uint8_t* src7, uint32_t size7) {
+    return nts1_codec_7to8(dest8, src7, size7);
+}
+
+uint32_t nts1_convert_8to7(uint8_t* dest7, const uint8_t* src8, uint32_t size8) {
+    return nts1_codec_8to7(dest7, src8, size8);
+}
+
+// ----------------------------------------------------
+
 nts1_status_t nts1_param_change(uint8_t id, uint8_t subid, uint16_t value) {
-    nts1_tx_param_change_t param;
-    param.param_id = id;
-    param.param_subid = subid;
-    param.msb = (value >> 7) & 0x7F;
-    param.lsb = value & 0x7F;
-    return nts1_send_param_change(&param);
+    // staged, goes out right away unless the tx buffer is backed up
+    const uint32_t primask = s_spi_tx_lock();
+    uint8_t staged = s_param_stage_put(id, subid, value);
+    if (!staged) {
+        // table full, make room if the tx buffer allows
+        s_param_stage_flush();
+        staged = s_param_stage_put(id, subid, value);
+    }
+    s_param_stage_flush();
+    s_spi_tx_unlock(primask);
+    return staged ? k_nts1_status_ok : k_nts1_status_busy;
 }
 
 nts1_status_t nts1_note_on(uint8_t note, uint8_t velo) {
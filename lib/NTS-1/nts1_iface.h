@@ -57,6 +57,47 @@ enum {
 
 typedef uint8_t nts1_tx_event_id_t;
 
+enum {
+  k_nts1_tx_lane_realtime = 0U, // notes, parameter changes
+  k_nts1_tx_lane_bulk,          // descriptor and value requests
+  k_nts1_num_tx_lanes,
+};
+
+typedef struct nts1_tx_lane_stats {
+  uint16_t depth;      // bytes queued
+  uint16_t max_depth;  // bytes queued, high water mark
+  uint16_t last_wait;  // bytes sent between queuing and sending a command, sampled
+  uint16_t max_wait;
+  uint32_t commands;   // commands queued
+  uint32_t refused;    // commands refused, lane full
+} nts1_tx_lane_stats_t;
+
+typedef struct nts1_link_stats {
+  uint32_t rx_bytes;            // bytes received, dummies included
+  uint32_t tx_bytes;            // command bytes sent, dummies excluded
+  uint32_t rx_overruns;         // bytes dropped, rx buffer full
+  uint32_t rx_dropped_frames;   // commands cut short by the next status byte
+  uint32_t rx_rejected_frames;  // events larger than the decode buffer
+  uint32_t tx_dropped_frames;   // commands refused, tx buffer full
+  uint32_t ack_waits;           // times the main board was asked to wait (ACK low)
+  uint32_t ack_wait_us;         // time spent with ACK low, microseconds
+  uint32_t ack_wait_max_us;     // longest single time with ACK low, microseconds
+  uint16_t rx_max_depth;        // unread rx bytes, high water mark
+  uint16_t tx_max_depth;        // queued tx bytes of both lanes, high water mark
+} nts1_link_stats_t;
+
+typedef struct nts1_idle_stats {
+  uint16_t budget_bytes;  // rx bytes parsed per nts1_idle() call, 0 for no limit
+  uint16_t budget_us;     // rx parsing time per nts1_idle() call, 0 for no limit
+  uint16_t last_bytes;    // rx bytes parsed by the last call
+  uint16_t last_us;       // time the last call spent parsing, microseconds
+  uint16_t max_us;        // longest time spent parsing in one call, microseconds
+  uint16_t backlog;       // unread rx bytes left after the last call
+  uint16_t max_backlog;   // unread rx bytes left after a call, high water mark
+  uint32_t budget_stops;  // calls that stopped on the budget with rx bytes left
+  uint32_t reentries;     // nts1_idle() called from a handler, rx parsing skipped
+} nts1_idle_stats_t;
+
 enum {
   k_nts1_rx_event_id_note_off        = 0x0U,
   k_nts1_rx_event_id_note_on         = 0x1U,
@@ -274,6 +315,13 @@ typedef struct {
   char     name[13];
 } nts1_rx_edit_param_desc_t;
 
+// Reply to a request sent with nts1_request(), by request event ID
+typedef union nts1_rx_reply {
+  nts1_rx_value_t value;                     // req_value, req_unit_count
+  nts1_rx_unit_desc_t unit_desc;             // req_unit_desc
+  nts1_rx_edit_param_desc_t edit_param_desc; // req_edit_param_desc
+} nts1_rx_reply_t;
+
 typedef void (*nts1_note_off_event_handler)(const nts1_rx_note_off_t *);
 typedef void (*nts1_note_on_event_handler)(const nts1_rx_note_on_t *);
 typedef void (*nts1_step_tick_event_handler)(void);
@@ -281,6 +329,9 @@ typedef void (*nts1_unit_desc_event_handler)(const nts1_rx_unit_desc_t *);
 typedef void (*nts1_edit_param_desc_event_handler)(const nts1_rx_edit_param_desc_t *);
 typedef void (*nts1_value_event_handler)(const nts1_rx_value_t *);
 typedef void (*nts1_param_change_handler)(const nts1_rx_param_change_t *);
+// k_nts1_status_ok with the reply, or k_nts1_status_timeout with NULL
+typedef void (*nts1_reply_handler)(nts1_status_t status, const nts1_rx_reply_t *reply,
+                                   void *context);
 
 #ifdef __cplusplus
 extern "C" {
@@ -288,8 +339,15 @@ extern "C" {
   
   nts1_status_t nts1_init();
   nts1_status_t nts1_teardown();
+  // Busy when called from a handler the parser is running, nothing is parsed then
   nts1_status_t nts1_idle();
+  // Rx bytes and parsing time after which nts1_idle() stops and leaves the rest for the
+  // next call, 0 for no limit. One command is always handled.
+  nts1_status_t nts1_set_idle_budget(uint16_t max_bytes, uint16_t max_us);
+  void nts1_get_idle_stats(nts1_idle_stats_t *stats);
+  void nts1_reset_idle_stats(void);
   
+  // Queues every event or, busy, none of them
   nts1_status_t nts1_send_events(nts1_tx_event_t *events, uint8_t count);
 
   static inline nts1_status_t nts1_send_event(nts1_tx_event_t *event) {
@@ -302,6 +360,42 @@ extern "C" {
     return nts1_send_param_changes(param_change, 1);
   }
 
+  // Send parameter changes followed by events as a single frame, end mark on the last
+  // command. Buffer space for the whole frame is checked first so it is either queued
+  // entirely or not at all.
+  nts1_status_t nts1_send_frame(const nts1_tx_param_change_t *param_changes, uint8_t param_count,
+                                const nts1_tx_event_t *events, uint8_t event_count);
+
+  // Send a request event (k_nts1_tx_event_id_req_*) with the main ID and sub ID or index
+  // the nts1_req_* functions use, and have handler called from nts1_idle() with the reply
+  // matching all three, or with k_nts1_status_timeout once timeout_us has passed. Busy
+  // while NTS1_MAX_PENDING_REQUESTS are outstanding or the bulk lane is full. Replies
+  // still go to the nts1_handle_* event handlers first.
+  nts1_status_t nts1_request(uint8_t event_id, uint8_t main_id, uint8_t sub_id,
+                             uint32_t timeout_us, nts1_reply_handler handler, void *context);
+  uint8_t nts1_pending_request_count(void);
+
+  void nts1_get_tx_lane_stats(uint8_t lane, nts1_tx_lane_stats_t *stats);
+  void nts1_reset_tx_lane_stats(void);
+  // Unread rx bytes at which the main board is held off (ACK low) and let go again,
+  // low < high, the largest command (127 bytes) <= high <= rx buffer size (half of it
+  // with DMA)
+  nts1_status_t nts1_set_rx_ack_watermarks(uint16_t high, uint16_t low);
+  // Hold the main board off (ACK low) whatever the rx level, around work that stalls the
+  // CPU such as flash programming. Quiet once no byte has been clocked for
+  // NTS1_HOLD_QUIET_US, which only happens while held.
+  void nts1_hold_main_board(uint8_t hold);
+  uint8_t nts1_main_board_quiet(void);
+  // Interrupts masked, nestable, around state that has to change along with the tx
+  // commands other contexts queue (a parameter value table kept with the changes sent).
+  // Keep it to a few cycles.
+  uint32_t nts1_tx_lock(void);
+  void nts1_tx_unlock(uint32_t primask);
+  // Whether a change of the parameter waits in the stage for tx buffer space
+  uint8_t nts1_param_staged(uint8_t id, uint8_t subid);
+  void nts1_get_link_stats(nts1_link_stats_t *stats);
+  void nts1_reset_link_stats(void);
+
   static inline uint32_t nts1_size_7to8(uint32_t size7) {
     return 7 * (size7 / 8) + size7%8 - 1;
   }
@@ -355,6 +449,10 @@ extern "C" {
   void nts1_handle_edit_param_desc_event(const nts1_rx_edit_param_desc_t *param_desc);
   void nts1_handle_value_event(const nts1_rx_value_t *value);
   void nts1_handle_param_change(const nts1_rx_param_change_t *param_change);
+
+  // TX notification, defined in C++ NTS1 object. Every parameter change queued on the tx
+  // buffer, staged or sent directly, with the tx lock held.
+  void nts1_param_change_queued(const nts1_tx_param_change_t *param_change);
   
 #ifdef __cplusplus
 }
@@ -0,0 +1,83 @@
+/**
+ * @file spsc_ring.h
+ * @brief Single producer, single consumer ring buffer.
+ *
+ * SPSC_RING_DEFINE(name, type, size) defines the ring type name_t and its name_*()
+ * functions. The size must be a power of 2 no larger than 0x8000.
+ *
+ * Indices run freely and are masked only when the buffer is accessed, so wrapping is a
+ * single AND and a full ring is told apart from an empty one without giving up a slot.
+ * The producer only writes widx and the consumer only writes ridx. Each side reads the
+ * other side's index before touching the data and publishes its own index after it is
+ * done with the data, with a fence in between so neither the compiler nor the CPU can
+ * move data accesses across the index update.
+ *
+ * Producer:  if (name_space(r) >= n) { name_poke(r, 0, a); ...; name_commit(r, n); }
+ * Consumer:  if (name_count(r) >= n) { a = name_peek(r, 0); ...; name_consume(r, n); }
+ */
+
+#ifndef __spsc_ring_h
+#define __spsc_ring_h
+
+#include <stdint.h>
+
+#define SPSC_RING_ACQUIRE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define SPSC_RING_RELEASE() __atomic_thread_fence(__ATOMIC_RELEASE)
+
+#define SPSC_RING_DEFINE(name, type, size)                                                         \
+    typedef char name##_size_check[((size) & ((size) - 1)) == 0 && (size) <= 0x8000 ? 1 : -1];     \
+                                                                                                   \
+    typedef struct {                                                                               \
+        volatile uint16_t widx; /* written by the producer only */                                 \
+        volatile uint16_t ridx; /* written by the consumer only */                                 \
+        type buf[size];                                                                            \
+    } name##_t;                                                                                    \
+                                                                                                   \
+    /* Only while neither side is running */                                                       \
+    static inline void name##_reset(name##_t* r) {                                                 \
+        r->widx = 0;                                                                               \
+        r->ridx = 0;                                                                               \
+    }                                                                                              \
+                                                                                                   \
+    static inline uint16_t name##_count(const name##_t* r) {                                       \
+        const uint16_t count = (uint16_t)(r->widx - r->ridx);                                      \
+        SPSC_RING_ACQUIRE();                                                                       \
+        return count;                                                                              \
+    }                                                                                              \
+                                                                                                   \
+    static inline uint16_t name##_space(const name##_t* r) {                                       \
+        return (uint16_t)((size) - name##_count(r));                                               \
+    }                                                                                              \
+                                                                                                   \
+    /* Producer: write ahead of widx, nothing is visible until committed */                        \
+    static inline void name##_poke(name##_t* r, uint16_t offset, type value) {                     \
+        r->buf[(uint16_t)(r->widx + offset) & ((size) - 1)] = value;                               \
+    }                                                                                              \
+                                                                                                   \
+    static inline void name##_commit(name##_t* r, uint16_t n) {                                    \
+        SPSC_RING_RELEASE();                                                                       \
+        r->widx = (uint16_t)(r->widx + n);                                                         \
+    }                                                                                              \
+                                                                                                   \
+    static inline void name##_put(name##_t* r, type value) {                                       \
+        name##_poke(r, 0, value);                                                                  \
+        name##_commit(r, 1);                                                                       \
+    }                                                                                              \
+                                                                                                   \
+    /* Consumer: read ahead of ridx, slots are handed back when consumed */                        \
+    static inline type name##_peek(const name##_t* r, uint16_t offset) {                           \
+        return r->buf[(uint16_t)(r->ridx + offset) & ((size) - 1)];                                \
+    }                                                                                              \
+                                                                                                   \
+    static inline void name##_consume(name##_t* r, uint16_t n) {                                   \
+        SPSC_RING_RELEASE();                                                                       \
+        r->ridx = (uint16_t)(r->ridx + n);                                                         \
+    }                                                                                              \
+                                                                                                   \
+    static inline type name##_get(name##_t* r) {                                                   \
+        const type value = name##_peek(r, 0);                                                      \
+        name##_consume(r, 1);                                                                      \
+        return value;                                                                              \
+    }
+
+#endif  // __spsc_ring_h
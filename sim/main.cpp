@@ -0,0 +1,403 @@
+// Host simulation of lib/NTS-1 against a model of the NTS-1 main board, see README.md
+
+#include <nts-1.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "main_board.h"
+#include "sim.h"
+
+mb_state_t g_mb;
+sim_state_t g_sim;
+
+// -- Measurements --------------------------------------------------------------------
+
+typedef struct {
+    uint32_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+} latency_t;
+
+static void latency_add(latency_t* lat, uint64_t ns) {
+    ++lat->count;
+    lat->sum_ns += ns;
+    if (ns > lat->max_ns) {
+        lat->max_ns = ns;
+    }
+}
+
+static void latency_print(const char* name, const latency_t* lat) {
+    printf("  %-22s %6lu  avg %7.1f us  max %7.1f us\n", name, (unsigned long)lat->count,
+           lat->count ? lat->sum_ns / 1000.0 / lat->count : 0.0, lat->max_ns / 1000.0);
+}
+
+static void print_link_stats() {
+    nts1_link_stats_t link;
+    nts1_tx_lane_stats_t rt, bulk;
+    NTS1::getLinkStats(&link);
+    NTS1::getTxLaneStats(NTS1::LANE_REALTIME, &rt);
+    NTS1::getTxLaneStats(NTS1::LANE_BULK, &bulk);
+
+    const double seconds = g_sim.bytes * (SIM_BYTE_NS / 1e9) + g_sim.stalled_ns / 1e9;
+    printf("  link: rx %lu B, tx %lu B (%.0f%% of the clocked bytes), %.1f kB/s clocked\n",
+           (unsigned long)link.rx_bytes, (unsigned long)link.tx_bytes,
+           g_sim.bytes ? 100.0 * link.tx_bytes / g_sim.bytes : 0.0,
+           seconds > 0 ? g_sim.bytes / seconds / 1000.0 : 0.0);
+    printf("  rx: overruns %lu, dropped %lu, rejected %lu, max depth %u\n",
+           (unsigned long)link.rx_overruns, (unsigned long)link.rx_dropped_frames,
+           (unsigned long)link.rx_rejected_frames, link.rx_max_depth);
+    printf("  tx: dropped %lu, max depth %u, realtime max wait %u B, bulk max wait %u B\n",
+           (unsigned long)link.tx_dropped_frames, link.tx_max_depth, rt.max_wait, bulk.max_wait);
+    printf("  ack: %lu waits, %lu us total, %lu us max (pin held low %lu us)\n",
+           (unsigned long)link.ack_waits, (unsigned long)link.ack_wait_us,
+           (unsigned long)link.ack_wait_max_us, (unsigned long)(g_sim.stalled_ns / 1000));
+}
+
+// -- Panel handlers ------------------------------------------------------------------
+
+static uint32_t s_ticks;
+static uint32_t s_unit_descs;
+static uint32_t s_edit_param_descs;
+static uint32_t s_values;
+static uint32_t s_param_changes;
+static uint64_t s_param_sent_ns[1024];  // by value
+static latency_t s_one_way;
+static latency_t s_round_trip;
+
+static void reset_counters() {
+    s_ticks = s_unit_descs = s_edit_param_descs = s_values = s_param_changes = 0;
+    memset(&s_one_way, 0, sizeof(s_one_way));
+    memset(&s_round_trip, 0, sizeof(s_round_trip));
+}
+
+struct PanelHandlers : NTS1Handlers {
+    static void onStepTickEvent() { ++s_ticks; }
+    static void onUnitDescEvent(const nts1_rx_unit_desc_t*) { ++s_unit_descs; }
+    static void onEditParamDescEvent(const nts1_rx_edit_param_desc_t*) { ++s_edit_param_descs; }
+    static void onValueEvent(const nts1_rx_value_t*) { ++s_values; }
+
+    static void onParamChange(const nts1_rx_param_change_t* param) {
+        ++s_param_changes;
+        const uint16_t value = (param->msb << 7) | param->lsb;
+        if (s_param_sent_ns[value % 1024]) {
+            latency_add(&s_round_trip, sim_time_ns() - s_param_sent_ns[value % 1024]);
+        }
+    }
+};
+
+NTS1_DISPATCH_HANDLERS(PanelHandlers, nts1)
+
+static void handle_mb_param(const nts1_tx_param_change_t* param, uint64_t time_ns) {
+    const uint16_t value = (param->msb << 7) | param->lsb;
+    if (s_param_sent_ns[value % 1024]) {
+        latency_add(&s_one_way, time_ns - s_param_sent_ns[value % 1024]);
+    }
+}
+
+// -- Scenarios -----------------------------------------------------------------------
+
+static void start(uint32_t loop_period_us, sim_loop_fn loop) {
+    mb_init(&g_mb);
+    reset_counters();
+    memset(s_param_sent_ns, 0, sizeof(s_param_sent_ns));
+    sim_start(&g_sim, &g_mb, loop_period_us, loop);
+}
+
+// Panel ID allocation, status and ACK requests
+static void scenario_handshake() {
+    printf("handshake\n");
+    start(100, NULL);
+    mb_send_panel_id(&g_mb);
+    mb_send_status_request(&g_mb);
+    mb_send_ack_request(&g_mb);
+    sim_run(&g_sim, 2000);
+    printf("  version %lu, bootmode %lu, ack %lu (expect 1, 2, 1)\n",
+           (unsigned long)g_mb.versions, (unsigned long)g_mb.bootmodes,
+           (unsigned long)g_mb.acks);
+    print_link_stats();
+}
+
+// A knob turned continuously: one parameter change per ms, echoed by the main board
+static uint16_t s_knob;
+
+static void loop_knob(uint64_t time_ns) {
+    static uint64_t next_ns;
+    if (time_ns < next_ns) {
+        return;
+    }
+    next_ns = time_ns + 1000000;
+    ++s_knob;
+    s_param_sent_ns[s_knob % 1024] = time_ns;
+    NTS1::paramChange(k_param_id_filt_cutoff, 0, s_knob % 1024);
+}
+
+static void scenario_param_latency() {
+    printf("parameter latency, 1 change per ms for 1 s, main loop every 100 us\n");
+    start(100, loop_knob);
+    g_mb.echo_params = true;
+    g_mb.on_param = handle_mb_param;
+    g_mb.tick_period_us = 5000;
+    sim_run(&g_sim, 1000000);
+    latency_print("panel -> main board", &s_one_way);
+    latency_print("round trip", &s_round_trip);
+    printf("  step ticks %lu\n", (unsigned long)s_ticks);
+    print_link_stats();
+}
+
+// Notes queued as fast as the tx buffer takes them
+static void loop_flood(uint64_t) {
+    static uint8_t note;
+    while (NTS1::noteOn(note & 0x7F, 100) == k_nts1_status_ok &&
+           NTS1::noteOff(note & 0x7F) == k_nts1_status_ok) {
+        ++note;
+    }
+}
+
+static void scenario_throughput() {
+    printf("tx throughput, notes flooded for 1 s, main loop every 50 us\n");
+    start(50, loop_flood);
+    sim_run(&g_sim, 1000000);
+    printf("  note on %lu, note off %lu\n", (unsigned long)g_mb.note_ons,
+           (unsigned long)g_mb.note_offs);
+    print_link_stats();
+}
+
+// Descriptor requests on the bulk lane while notes play on the realtime lane
+static uint8_t s_requests_sent;
+static uint64_t s_requests_done_ns;
+
+static void loop_browse(uint64_t time_ns) {
+    static uint64_t next_note_ns;
+    if (time_ns >= next_note_ns) {
+        next_note_ns = time_ns + 1000000;
+        NTS1::noteOn(60, 100);
+        NTS1::noteOff(60);
+    }
+
+    // unit count, unit descriptors, edit parameter descriptors
+    const uint8_t num_requests = 1 + k_mb_num_units + k_mb_num_edit_params;
+    while (s_requests_sent < num_requests) {
+        const uint8_t i = s_requests_sent;
+        uint8_t res;
+        if (i == 0) {
+            res = NTS1::reqOscCount();
+        } else if (i <= k_mb_num_units) {
+            res = NTS1::reqOscDesc(i - 1);
+        } else {
+            res = NTS1::reqOscEditParamDesc(i - 1 - k_mb_num_units);
+        }
+        if (res != k_nts1_status_ok) {
+            break;
+        }
+        ++s_requests_sent;
+    }
+    if (!s_requests_done_ns && s_values == 1 && s_unit_descs == k_mb_num_units &&
+        s_edit_param_descs == k_mb_num_edit_params) {
+        s_requests_done_ns = time_ns;
+    }
+}
+
+static void scenario_descriptors() {
+    printf("descriptor requests with a note per ms, main loop every 100 us\n");
+    s_requests_sent = 0;
+    s_requests_done_ns = 0;
+    start(100, loop_browse);
+    const uint64_t start_ns = sim_time_ns();
+    sim_run(&g_sim, 100000);
+    printf("  count %lu, units %lu, edit params %lu, all in %.1f us\n", (unsigned long)s_values,
+           (unsigned long)s_unit_descs, (unsigned long)s_edit_param_descs,
+           s_requests_done_ns ? (s_requests_done_ns - start_ns) / 1000.0 : -1.0);
+    print_link_stats();
+}
+
+// Value requests kept in flight as long as a pending slot is free, with every 10th one
+// left unanswered by the main board
+static uint16_t s_reqs_sent;
+static uint16_t s_reqs_ok;
+static uint16_t s_reqs_timed_out;
+static uint16_t s_reqs_mismatched;
+static uint64_t s_reqs_done_ns;
+
+static void handle_reply(uint8_t status, const nts1_rx_reply_t* reply, void* context) {
+    const uint8_t id = (uint8_t)(uintptr_t)context;
+    if (status == NTS1::STATUS_TIMEOUT) {
+        ++s_reqs_timed_out;
+    } else if (reply->value.main_id == id) {
+        ++s_reqs_ok;
+    } else {
+        ++s_reqs_mismatched;
+    }
+    if (s_reqs_ok + s_reqs_timed_out + s_reqs_mismatched == 200) {
+        s_reqs_done_ns = sim_time_ns();
+    }
+}
+
+static void loop_pipeline(uint64_t) {
+    while (s_reqs_sent < 200) {
+        const uint8_t id = s_reqs_sent % k_num_param_id;
+        if (NTS1::reqParamValue(id, 0, 2000, handle_reply, (void*)(uintptr_t)id) !=
+            NTS1::STATUS_OK) {
+            break;
+        }
+        ++s_reqs_sent;
+    }
+}
+
+static void scenario_pipeline() {
+    printf("200 value requests pipelined, 2 ms timeout, every 10th unanswered\n");
+    s_reqs_sent = s_reqs_ok = s_reqs_timed_out = s_reqs_mismatched = 0;
+    s_reqs_done_ns = 0;
+    start(100, loop_pipeline);
+    g_mb.drop_requests = 10;
+    const uint64_t start_ns = sim_time_ns();
+    sim_run(&g_sim, 100000);
+    printf("  replies %u, timeouts %u, mismatched %u, all in %.1f us\n", s_reqs_ok,
+           s_reqs_timed_out, s_reqs_mismatched,
+           s_reqs_done_ns ? (s_reqs_done_ns - start_ns) / 1000.0 : -1.0);
+    print_link_stats();
+}
+
+// Unit catalog read from the main board into a blank flash, served from flash after a
+// reset, and read again once the main board reports another version
+static uint64_t s_catalog_ready_ns;  // last time it became ready
+static bool s_catalog_was_ready;
+
+static void loop_catalog(uint64_t time_ns) {
+    NTS1::catalogIdle();
+    const bool ready = NTS1::isCatalogReady();
+    if (ready && !s_catalog_was_ready) {
+        s_catalog_ready_ns = time_ns;
+    }
+    s_catalog_was_ready = ready;
+}
+
+static void catalog_boot(const char* name, uint16_t version) {
+    start(100, loop_catalog);
+    g_mb.version = version;
+    NTS1::catalogInit();
+    const bool ready_at_boot = NTS1::isCatalogReady();
+    const uint64_t start_ns = sim_time_ns();
+    s_catalog_ready_ns = start_ns;
+    s_catalog_was_ready = ready_at_boot;
+    sim_run(&g_sim, 200000);
+    uint16_t units = 0;
+    for (uint8_t t = 0; t < NTS1::NUM_UNIT_TYPES; ++t) {
+        units += NTS1::getUnitCount(t);
+    }
+    printf("  %-22s ready at boot %s, %u units, %lu requests, ready after %.1f us\n", name,
+           ready_at_boot ? "yes" : "no", units, (unsigned long)g_mb.requests,
+           NTS1::isCatalogReady() ? (s_catalog_ready_ns - start_ns) / 1000.0 : -1.0);
+}
+
+static void scenario_catalog() {
+    printf("unit catalog, main loop every 100 us\n");
+    catalog_boot("blank flash", 1);
+    const char* name = NTS1::getUnitName(NTS1::UNIT_TYPE_REVERB, 3);
+    printf("  reverb 3 \"%s\", osc 0 \"%s\", pool %s\n", name ? name : "?",
+           NTS1::getUnitName(NTS1::UNIT_TYPE_OSC, 0),
+           NTS1::getUnitName(NTS1::UNIT_TYPE_OSC, 0) ==
+                   NTS1::getUnitName(NTS1::UNIT_TYPE_FILTER, 0)
+               ? "shared"
+               : "not shared");
+    print_link_stats();
+    catalog_boot("reset", 1);
+    catalog_boot("new main board version", 2);
+}
+
+// A burst of parameter changes from the main board while the main loop is stuck for
+// 20 ms at a time, with and without the main board honoring ACK
+static void scenario_overflow(bool honor_ack) {
+    printf("rx burst of 400 parameter changes, main loop every 20 ms, ACK %s\n",
+           honor_ack ? "honored" : "ignored");
+    start(20000, NULL);
+    g_mb.honor_ack = honor_ack;
+    g_mb.tick_period_us = 1000;
+    for (uint16_t i = 0; i < 400; ++i) {
+        mb_send_param_change(&g_mb, k_param_id_filt_cutoff, 0, i);
+    }
+    sim_run(&g_sim, 200000);
+    printf("  parameter changes %lu of 400, step ticks %lu of %lu\n",
+           (unsigned long)s_param_changes, (unsigned long)s_ticks,
+           (unsigned long)g_mb.events_sent);
+    print_link_stats();
+}
+
+// The same burst with the main loop every ms, parsing all of it per idle() call or
+// within a byte budget
+static uint16_t s_idle_max_bytes;
+
+static void loop_budget(uint64_t) {
+    nts1_idle_stats_t idle;
+    NTS1::getIdleStats(&idle);
+    if (idle.last_bytes > s_idle_max_bytes) {
+        s_idle_max_bytes = idle.last_bytes;
+    }
+}
+
+static void scenario_idle_budget(uint16_t budget_bytes) {
+    printf("rx burst of 400 parameter changes, main loop every 1 ms, idle budget %u B\n",
+           budget_bytes);
+    start(1000, loop_budget);
+    NTS1::setIdleBudget(budget_bytes, 0);
+    s_idle_max_bytes = 0;
+    for (uint16_t i = 0; i < 400; ++i) {
+        mb_send_param_change(&g_mb, k_param_id_filt_cutoff, 0, i);
+    }
+    sim_run(&g_sim, 200000);
+    NTS1::setIdleBudget(0, 0);
+
+    nts1_idle_stats_t idle;
+    NTS1::getIdleStats(&idle);
+    printf("  parameter changes %lu of 400, parsed per call max %u B, backlog max %u B, "
+           "budget stops %lu\n",
+           (unsigned long)s_param_changes, s_idle_max_bytes, idle.max_backlog,
+           (unsigned long)idle.budget_stops);
+    print_link_stats();
+}
+
+// A parameter changed to A, then B, then back to A as soon as A's echo is in, before
+// B's: the echo of A must not make the last change look like it was already sent
+static uint8_t s_echo_phase;
+
+static void loop_echo(uint64_t) {
+    if (s_echo_phase == 0) {
+        NTS1::paramChange(k_param_id_filt_cutoff, 0, 100);
+        NTS1::paramChange(k_param_id_filt_cutoff, 0, 200);
+        s_echo_phase = 1;
+    } else if (s_echo_phase == 1 && s_param_changes == 1) {
+        NTS1::paramChange(k_param_id_filt_cutoff, 0, 100);
+        s_echo_phase = 2;
+    }
+}
+
+static void scenario_param_echo() {
+    printf("parameter changed A, B, A with A's echo in between, one change parsed per idle()\n");
+    start(100, loop_echo);
+    NTS1::invalidateParamValues();
+    NTS1::setIdleBudget(5, 0);
+    g_mb.echo_params = true;
+    s_echo_phase = 0;
+    sim_run(&g_sim, 10000);
+    NTS1::setIdleBudget(0, 0);
+    printf("  main board %u, recorded %u, echoes %lu (expect 100, 100, 3)\n",
+           g_mb.params[k_param_id_filt_cutoff][0],
+           NTS1::getParamValue(k_param_id_filt_cutoff, 0), (unsigned long)s_param_changes);
+}
+
+// -- MAIN ----------------------------------------------------------------------------
+
+int main() {
+    printf("SPI byte period %u ns\n\n", (unsigned)SIM_BYTE_NS);
+    scenario_handshake();
+    scenario_param_latency();
+    scenario_param_echo();
+    scenario_throughput();
+    scenario_descriptors();
+    scenario_pipeline();
+    scenario_catalog();
+    scenario_overflow(true);
+    scenario_overflow(false);
+    scenario_idle_budget(0);
+    scenario_idle_budget(48);
+    return 0;
+}
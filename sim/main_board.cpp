@@ -0,0 +1,259 @@
+#include "main_board.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Status bytes, [1][e][ppp][ccc]
+#define k_mb_cmd_event 0x84
+#define k_mb_cmd_param 0x85
+#define k_mb_cmd_other 0x86
+#define k_mb_cmd_dummy 0x87
+#define k_mb_cmd_mask 0x87          // end mark and panel ID stripped
+#define k_mb_cmd_panel_id_all 0xBE  // other command to ppp=7, panel ID allocation
+
+#define k_mb_status(cmd) ((cmd) | (k_mb_ppp << 3))
+
+enum { k_mb_subcmd_panel_id = 0x0, k_mb_subcmd_status = 0x1, k_mb_subcmd_ack = 0x3 };
+enum { k_mb_subcmd_version = 0x10, k_mb_subcmd_bootmode = 0x11 };
+
+// -- Host -> panel -------------------------------------------------------------------
+
+uint16_t mb_tx_pending(const mb_state_t* mb) { return mb->tx_widx - mb->tx_ridx; }
+
+static bool mb_queue(mb_state_t* mb, const uint8_t* data, uint16_t size) {
+    if (k_mb_tx_size - mb_tx_pending(mb) < size) {
+        ++mb->tx_dropped;
+        return false;
+    }
+    for (uint16_t i = 0; i < size; ++i) {
+        mb->tx[mb->tx_widx++ % k_mb_tx_size] = data[i];
+    }
+    return true;
+}
+
+// Events carry their payload as 7 bit data, size counts the status byte
+static bool mb_queue_event(mb_state_t* mb, uint8_t event_id, const void* payload,
+                           uint8_t size8) {
+    uint8_t payload8[64 + 1] = {0};  // one spare byte, the encoder may read past the end
+    uint8_t frame[3 + 80];
+    memcpy(payload8, payload, size8);
+    const uint32_t size7 = nts1_convert_8to7(frame + 3, payload8, size8);
+    frame[0] = k_mb_status(k_mb_cmd_event);
+    frame[1] = 3 + size7;
+    frame[2] = event_id;
+    if (!mb_queue(mb, frame, 3 + size7)) {
+        return false;
+    }
+    ++mb->events_sent;
+    return true;
+}
+
+bool mb_send_panel_id(mb_state_t* mb) {
+    const uint8_t frame[] = {k_mb_cmd_panel_id_all, 4, k_mb_subcmd_panel_id, k_mb_ppp};
+    return mb_queue(mb, frame, sizeof(frame));
+}
+
+bool mb_send_status_request(mb_state_t* mb) {
+    const uint8_t frame[] = {k_mb_status(k_mb_cmd_other), 3, k_mb_subcmd_status};
+    return mb_queue(mb, frame, sizeof(frame));
+}
+
+bool mb_send_ack_request(mb_state_t* mb) {
+    const uint8_t frame[] = {k_mb_status(k_mb_cmd_other), 3, k_mb_subcmd_ack};
+    return mb_queue(mb, frame, sizeof(frame));
+}
+
+// The panel takes an event without payload for a malformed one, the tick carries a
+// single 7 bit byte
+bool mb_send_step_tick(mb_state_t* mb) {
+    const uint8_t frame[] = {k_mb_status(k_mb_cmd_event), 4, k_nts1_rx_event_id_step_tick, 0};
+    if (!mb_queue(mb, frame, sizeof(frame))) {
+        return false;
+    }
+    ++mb->events_sent;
+    return true;
+}
+
+bool mb_send_param_change(mb_state_t* mb, uint8_t id, uint8_t subid, uint16_t value) {
+    const uint8_t frame[] = {k_mb_status(k_mb_cmd_param), (uint8_t)(id & 0x7F),
+                             (uint8_t)(subid & 0x7F), (uint8_t)((value >> 7) & 0x7F),
+                             (uint8_t)(value & 0x7F)};
+    return mb_queue(mb, frame, sizeof(frame));
+}
+
+// -- Requests ------------------------------------------------------------------------
+
+static void mb_reply_value(mb_state_t* mb, uint8_t req_id, uint8_t main_id, uint8_t sub_id,
+                           uint16_t value) {
+    nts1_rx_value_t reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.req_id = req_id;
+    reply.main_id = main_id;
+    reply.sub_id = sub_id;
+    reply.value = value;
+    mb_queue_event(mb, k_nts1_rx_event_id_value, &reply, sizeof(reply));
+}
+
+static void mb_reply_unit_desc(mb_state_t* mb, uint8_t main_id, uint8_t sub_id) {
+    nts1_rx_unit_desc_t reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.main_id = main_id;
+    reply.sub_id = sub_id;
+    reply.param_count = k_mb_num_edit_params;
+    if (sub_id == 0) {
+        snprintf(reply.name, sizeof(reply.name), "OFF");
+    } else {
+        snprintf(reply.name, sizeof(reply.name), "UNIT %u.%u", main_id, sub_id);
+    }
+    mb_queue_event(mb, k_nts1_rx_event_id_unit_desc, &reply, sizeof(reply));
+}
+
+static void mb_reply_edit_param_desc(mb_state_t* mb, uint8_t main_id, uint8_t sub_id) {
+    nts1_rx_edit_param_desc_t reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.main_id = main_id;
+    reply.sub_id = sub_id;
+    reply.min = 0;
+    reply.max = 100;
+    snprintf(reply.name, sizeof(reply.name), "PARAM %u", sub_id);
+    mb_queue_event(mb, k_nts1_rx_event_id_edit_param_desc, &reply, sizeof(reply));
+}
+
+static void mb_handle_event(mb_state_t* mb, uint8_t event_id, uint8_t msb, uint8_t lsb) {
+    if (event_id >= k_nts1_tx_event_id_req_unit_count && mb->drop_requests &&
+        (mb->requests + 1) % mb->drop_requests == 0) {
+        ++mb->requests;
+        return;
+    }
+    switch (event_id) {
+        case k_nts1_tx_event_id_note_on:
+            ++mb->note_ons;
+            break;
+        case k_nts1_tx_event_id_note_off:
+            ++mb->note_offs;
+            break;
+        case k_nts1_tx_event_id_req_unit_count:
+            ++mb->requests;
+            mb_reply_value(mb, event_id, msb, 0, k_mb_num_units);
+            break;
+        case k_nts1_tx_event_id_req_unit_desc:
+            ++mb->requests;
+            mb_reply_unit_desc(mb, msb, lsb);
+            break;
+        case k_nts1_tx_event_id_req_edit_param_desc:
+            ++mb->requests;
+            mb_reply_edit_param_desc(mb, msb, lsb);
+            break;
+        case k_nts1_tx_event_id_req_value:
+            ++mb->requests;
+            if (msb == k_param_id_sys_version) {
+                mb_reply_value(mb, event_id, msb, lsb, mb->version);
+            } else {
+                mb_reply_value(mb, event_id, msb, lsb,
+                               (msb < k_num_param_id) ? mb->params[msb][lsb % k_mb_num_subids] : 0);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void mb_handle_param(mb_state_t* mb, const uint8_t* data, uint64_t time_ns) {
+    nts1_tx_param_change_t param;
+    param.param_id = data[0];
+    param.param_subid = data[1];
+    param.msb = data[2];
+    param.lsb = data[3];
+    const uint16_t value = (param.msb << 7) | param.lsb;
+
+    ++mb->param_changes;
+    if (param.param_id < k_num_param_id) {
+        mb->params[param.param_id][param.param_subid % k_mb_num_subids] = value;
+    }
+    if (mb->on_param) {
+        mb->on_param(&param, time_ns);
+    }
+    if (mb->echo_params) {
+        mb_send_param_change(mb, param.param_id, param.param_subid, value);
+    }
+}
+
+static void mb_handle_other(mb_state_t* mb, uint8_t subcmd) {
+    switch (subcmd) {
+        case k_mb_subcmd_ack:
+            ++mb->acks;
+            break;
+        case k_mb_subcmd_version:
+            ++mb->versions;
+            break;
+        case k_mb_subcmd_bootmode:
+            ++mb->bootmodes;
+            break;
+        default:
+            break;
+    }
+}
+
+// -- SPI -----------------------------------------------------------------------------
+
+void mb_init(mb_state_t* mb) {
+    memset(mb, 0, sizeof(*mb));
+    mb->honor_ack = true;
+}
+
+void mb_update(mb_state_t* mb, uint64_t time_ns) {
+    if (!mb->tick_period_us) {
+        return;
+    }
+    if (time_ns >= mb->next_tick_ns) {
+        mb_send_step_tick(mb);
+        mb->next_tick_ns = time_ns + 1000ULL * mb->tick_period_us;
+    }
+}
+
+uint8_t mb_next_mosi(mb_state_t* mb) {
+    if (!mb_tx_pending(mb)) {
+        return k_mb_status(k_mb_cmd_dummy);
+    }
+    return mb->tx[mb->tx_ridx++ % k_mb_tx_size];
+}
+
+// Commands are only taken from status bytes carrying the assigned panel ID, the panel
+// sends ppp=7 until it has been assigned one
+void mb_receive(mb_state_t* mb, uint8_t miso, uint64_t time_ns) {
+    if (miso & 0x80) {
+        const uint8_t cmd = miso & k_mb_cmd_mask;
+        const uint8_t ppp = (miso >> 3) & 0x7;
+        mb->rx_cmd = (cmd == k_mb_cmd_dummy || ppp != k_mb_ppp) ? 0 : cmd;
+        mb->rx_count = 0;
+        return;
+    }
+    if (!mb->rx_cmd || mb->rx_count == sizeof(mb->rx)) {
+        return;
+    }
+    mb->rx[mb->rx_count++] = miso;
+
+    switch (mb->rx_cmd) {
+        case k_mb_cmd_event:  // event ID, msb, lsb
+            if (mb->rx_count == 3) {
+                mb_handle_event(mb, mb->rx[0], mb->rx[1], mb->rx[2]);
+                mb->rx_cmd = 0;
+            }
+            break;
+        case k_mb_cmd_param:  // ID, sub ID, msb, lsb
+            if (mb->rx_count == 4) {
+                mb_handle_param(mb, mb->rx, time_ns);
+                mb->rx_cmd = 0;
+            }
+            break;
+        case k_mb_cmd_other:  // size, sub command, ...
+            if (mb->rx_count >= 2 && mb->rx_count + 1 >= mb->rx[0]) {
+                mb_handle_other(mb, mb->rx[1]);
+                mb->rx_cmd = 0;
+            }
+            break;
+        default:
+            mb->rx_cmd = 0;
+            break;
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef SIM_MAIN_BOARD_H_
+#define SIM_MAIN_BOARD_H_
+
+#include <nts1_iface.h>
+#include <stdint.h>
+
+// -- MAIN BOARD model ----------------------------------------------------------------
+//
+// Host side of the panel protocol as lib/NTS-1 sees it: the main board is the SPI
+// master, sends commands or dummies on every byte while the panel's ACK is high and
+// parses what the panel sends back. It assigns a panel ID, answers status and ACK
+// requests, echoes parameter changes, sends step ticks and answers unit count, unit
+// descriptor, edit parameter descriptor and value requests from a made up catalog in
+// which the first unit of every type is called OFF.
+
+#define k_mb_ppp 1              // panel ID assigned to the panel
+#define k_mb_tx_size 2048       // host -> panel commands waiting to be clocked out
+#define k_mb_num_units 8        // per module type
+#define k_mb_num_edit_params 6  // per unit
+#define k_mb_num_subids 8
+
+typedef void (*mb_param_handler)(const nts1_tx_param_change_t* param, uint64_t time_ns);
+
+typedef struct {
+    // configuration
+    bool honor_ack;           // stop clocking while ACK is low, as the main board does
+    bool echo_params;         // send received parameter changes back
+    uint32_t tick_period_us;  // step tick events, 0 for none
+    uint32_t drop_requests;   // leave every nth request unanswered, 0 for none
+    uint16_t version;         // reported for k_param_id_sys_version
+    mb_param_handler on_param;
+
+    // host -> panel
+    uint8_t tx[k_mb_tx_size];
+    uint16_t tx_ridx;
+    uint16_t tx_widx;
+    uint64_t next_tick_ns;
+
+    // panel -> host
+    uint8_t rx_cmd;  // command being received, 0 for none
+    uint8_t rx_count;
+    uint8_t rx[8];
+
+    uint16_t params[k_num_param_id][k_mb_num_subids];
+
+    // counters
+    uint32_t versions;
+    uint32_t bootmodes;
+    uint32_t acks;
+    uint32_t note_ons;
+    uint32_t note_offs;
+    uint32_t param_changes;
+    uint32_t requests;
+    uint32_t events_sent;
+    uint32_t tx_dropped;  // commands not queued, tx full
+} mb_state_t;
+
+void mb_init(mb_state_t* mb);
+
+// Commands from the main board, queued whole or not at all
+bool mb_send_panel_id(mb_state_t* mb);
+bool mb_send_status_request(mb_state_t* mb);
+bool mb_send_ack_request(mb_state_t* mb);
+bool mb_send_step_tick(mb_state_t* mb);
+bool mb_send_param_change(mb_state_t* mb, uint8_t id, uint8_t subid, uint16_t value);
+
+uint16_t mb_tx_pending(const mb_state_t* mb);
+
+// One SPI byte: the byte the main board clocks out, then the byte it gets back
+void mb_update(mb_state_t* mb, uint64_t time_ns);
+uint8_t mb_next_mosi(mb_state_t* mb);
+void mb_receive(mb_state_t* mb, uint8_t miso, uint64_t time_ns);
+
+#endif  // SIM_MAIN_BOARD_H_
@@ -0,0 +1,8 @@
+// Host shim, see stm32_def.h
+
+#ifndef SIM_SHIM_PERIPHERALPINS_H_
+#define SIM_SHIM_PERIPHERALPINS_H_
+
+#include "stm32_def.h"
+
+#endif  // SIM_SHIM_PERIPHERALPINS_H_
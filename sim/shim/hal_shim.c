@@ -0,0 +1,44 @@
+// Host shim state, see stm32_def.h
+
+#include "stm32f0xx_hal.h"
+
+GPIO_TypeDef g_sim_gpiob;
+SPI_TypeDef g_sim_spi2;
+
+uint32_t g_sim_primask;
+uint32_t g_sim_spi_rxne;
+uint64_t g_sim_time_ns;
+uint8_t g_sim_flash[SIM_FLASH_SIZE] = {[0 ... SIM_FLASH_SIZE - 1] = 0xFF};
+
+uint32_t getCurrentMicros(void) { return (uint32_t)(g_sim_time_ns / 1000); }
+
+static uint8_t* sim_flash_at(uintptr_t address, uint32_t size) {
+    const uintptr_t begin = (uintptr_t)g_sim_flash;
+    if (address < begin || address + size > begin + SIM_FLASH_SIZE) {
+        return NULL;
+    }
+    return (uint8_t*)address;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t type, uintptr_t address, uint64_t data) {
+    uint8_t* at = sim_flash_at(address, 2);
+    if (type != FLASH_TYPEPROGRAM_HALFWORD || at == NULL || (address & 0x1) ||
+        at[0] != 0xFF || at[1] != 0xFF) {
+        return HAL_ERROR;
+    }
+    at[0] = (uint8_t)data;
+    at[1] = (uint8_t)(data >> 8);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef* erase, uint32_t* page_error) {
+    uint8_t* at = sim_flash_at(erase->PageAddress, erase->NbPages * FLASH_PAGE_SIZE);
+    *page_error = 0xFFFFFFFF;
+    if (at == NULL) {
+        return HAL_ERROR;
+    }
+    for (uint32_t i = 0; i < erase->NbPages * FLASH_PAGE_SIZE; ++i) {
+        at[i] = 0xFF;
+    }
+    return HAL_OK;
+}
@@ -0,0 +1,66 @@
+// Host shim of the STM32duino core and STM32F0 HAL, only what lib/NTS-1 uses. The
+// peripherals are plain structs the simulation reads and writes, see sim/README.md.
+
+#ifndef SIM_SHIM_STM32_DEF_H_
+#define SIM_SHIM_STM32_DEF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(NTS1_SPI_USE_DMA) && NTS1_SPI_USE_DMA
+#error "the host simulation only models the interrupt driven SPI transport"
+#endif
+
+#define __IO volatile
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// -- Registers -----------------------------------------------------------------------
+
+typedef struct {
+    __IO uint32_t MODER, OTYPER, OSPEEDR, PUPDR, IDR, ODR, BSRR, LCKR, AFR[2], BRR;
+} GPIO_TypeDef;
+
+typedef struct {
+    __IO uint32_t CR1, CR2, SR, DR, CRCPR, RXCRCR, TXCRCR, I2SCFGR, I2SPR;
+} SPI_TypeDef;
+
+extern GPIO_TypeDef g_sim_gpiob;
+extern SPI_TypeDef g_sim_spi2;
+
+#define GPIOB (&g_sim_gpiob)
+#define SPI2 (&g_sim_spi2)
+
+// -- Interrupts ----------------------------------------------------------------------
+
+// Interrupts are only ever raised by the simulation between calls into the library, so
+// masking them just has to be tracked
+extern uint32_t g_sim_primask;
+
+static inline uint32_t __get_PRIMASK(void) { return g_sim_primask; }
+static inline void __set_PRIMASK(uint32_t primask) { g_sim_primask = primask; }
+static inline void __disable_irq(void) { g_sim_primask = 1; }
+static inline void __enable_irq(void) { g_sim_primask = 0; }
+
+// -- Flash ---------------------------------------------------------------------------
+
+// The unit catalog's flash region, erased at start up like a blank chip
+#define SIM_FLASH_SIZE 0x800
+extern uint8_t g_sim_flash[SIM_FLASH_SIZE];
+
+#define NTS1_CATALOG_FLASH_ADDR ((uintptr_t)g_sim_flash)
+#define NTS1_CATALOG_FLASH_SIZE SIM_FLASH_SIZE
+
+// -- Time ----------------------------------------------------------------------------
+
+extern uint64_t g_sim_time_ns;
+
+uint32_t getCurrentMicros(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SIM_SHIM_STM32_DEF_H_
@@ -0,0 +1,113 @@
+// Host shim of the STM32F0 HAL, see stm32_def.h
+
+#ifndef SIM_SHIM_STM32F0XX_HAL_H_
+#define SIM_SHIM_STM32F0XX_HAL_H_
+
+#include "stm32_def.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum { HAL_OK = 0, HAL_ERROR, HAL_BUSY, HAL_TIMEOUT } HAL_StatusTypeDef;
+
+typedef struct {
+    uint32_t Pin, Mode, Pull, Speed, Alternate;
+} GPIO_InitTypeDef;
+
+typedef struct {
+    uint32_t Mode, Direction, DataSize, CLKPolarity, CLKPhase, NSS, BaudRatePrescaler, FirstBit,
+        TIMode, CRCCalculation, CRCPolynomial, CRCLength, NSSPMode;
+} SPI_InitTypeDef;
+
+typedef struct {
+    SPI_TypeDef* Instance;
+    SPI_InitTypeDef Init;
+} SPI_HandleTypeDef;
+
+typedef enum { SPI2_IRQn = 26 } IRQn_Type;
+
+static inline void HAL_GPIO_Init(GPIO_TypeDef* port, GPIO_InitTypeDef* init) {
+    (void)port;
+    (void)init;
+}
+static inline HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef* spi) {
+    (void)spi;
+    return HAL_OK;
+}
+static inline void HAL_NVIC_SetPriority(IRQn_Type irq, uint32_t prio, uint32_t sub) {
+    (void)irq;
+    (void)prio;
+    (void)sub;
+}
+static inline void HAL_NVIC_EnableIRQ(IRQn_Type irq) { (void)irq; }
+static inline void HAL_NVIC_DisableIRQ(IRQn_Type irq) { (void)irq; }
+
+// Flash keeps its semantics: erase sets whole pages, programming only clears bits of an
+// erased half word
+typedef struct {
+    uint32_t TypeErase;
+    uintptr_t PageAddress;
+    uint32_t NbPages;
+} FLASH_EraseInitTypeDef;
+
+#define FLASH_TYPEERASE_PAGES 0U
+#define FLASH_TYPEPROGRAM_HALFWORD 1U
+#define FLASH_PAGE_SIZE 0x400U
+
+static inline HAL_StatusTypeDef HAL_FLASH_Unlock(void) { return HAL_OK; }
+static inline HAL_StatusTypeDef HAL_FLASH_Lock(void) { return HAL_OK; }
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t type, uintptr_t address, uint64_t data);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef* erase, uint32_t* page_error);
+
+#define __HAL_RCC_GPIOB_CLK_ENABLE()
+#define __HAL_RCC_SYSCFG_CLK_ENABLE()
+#define __HAL_RCC_SPI2_FORCE_RESET()
+#define __HAL_RCC_SPI2_RELEASE_RESET()
+#define __HAL_RCC_SPI2_CLK_ENABLE()
+#define __HAL_RCC_SPI2_CLK_DISABLE()
+#define __HAL_SPI_ENABLE(h)
+#define __HAL_SPI_DISABLE(h)
+
+#define GPIO_PIN_12 (1U << 12)
+#define GPIO_PIN_13 (1U << 13)
+#define GPIO_PIN_14 (1U << 14)
+#define GPIO_PIN_15 (1U << 15)
+#define GPIO_MODE_OUTPUT_PP 1U
+#define GPIO_MODE_AF_PP 2U
+#define GPIO_SPEED_FREQ_HIGH 3U
+#define GPIO_NOPULL 0U
+#define GPIO_PULLUP 1U
+#define GPIO_AF0_SPI2 0U
+
+#define SPI_MODE_SLAVE 0U
+#define SPI_DIRECTION_2LINES 0U
+#define SPI_DATASIZE_8BIT 0x700U
+#define SPI_POLARITY_HIGH 2U
+#define SPI_PHASE_2EDGE 1U
+#define SPI_NSS_SOFT 0x200U
+#define SPI_BAUDRATEPRESCALER_2 0U
+#define SPI_FIRSTBIT_LSB 0x80U
+#define SPI_TIMODE_DISABLE 0U
+#define SPI_CRCCALCULATION_DISABLE 0U
+#define SPI_CRC_LENGTH_DATASIZE 0U
+#define SPI_NSS_PULSE_DISABLE 0U
+#define SPI_IT_RXNE (1U << 6)
+
+// On the chip reading DR clears RXNE. The simulation hands the interrupt one byte at a
+// time, so RXNE reads as set exactly once per byte.
+extern uint32_t g_sim_spi_rxne;
+
+static inline uint32_t sim_spi_rxne(void) {
+    const uint32_t rxne = g_sim_spi_rxne;
+    g_sim_spi_rxne = 0;
+    return rxne;
+}
+
+#define SPI_SR_RXNE (sim_spi_rxne())
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SIM_SHIM_STM32F0XX_HAL_H_
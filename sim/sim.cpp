@@ -0,0 +1,65 @@
+#include "sim.h"
+
+#include <nts-1.h>
+#include <stm32f0xx_hal.h>
+
+#define k_sim_ack_pin GPIO_PIN_12
+
+extern "C" void SPI2_IRQHandler(void);
+
+uint64_t sim_time_ns() { return g_sim_time_ns; }
+
+bool sim_ack() { return g_sim_gpiob.ODR & k_sim_ack_pin; }
+
+// The library sets and clears the ACK pin through BSRR / BRR, latch that into ODR
+static void sim_gpio_sync() {
+    GPIO_TypeDef* port = GPIOB;
+    port->ODR |= port->BSRR & 0xFFFF;
+    port->ODR &= ~((port->BSRR >> 16) | port->BRR);
+    port->BSRR = 0;
+    port->BRR = 0;
+}
+
+void sim_start(sim_state_t* sim, mb_state_t* mb, uint32_t loop_period_us, sim_loop_fn loop) {
+    sim->mb = mb;
+    sim->loop_period_us = loop_period_us;
+    sim->loop = loop;
+    sim->next_loop_ns = g_sim_time_ns;
+    sim->bytes = 0;
+    sim->stalled_ns = 0;
+
+    g_sim_spi2.SR = 1;  // RXNE is handed out by sim_spi_rxne()
+    NTS1::init();
+    sim_gpio_sync();
+    NTS1::resetLinkStats();
+    NTS1::resetTxLaneStats();
+    NTS1::resetIdleStats();
+}
+
+void sim_run(sim_state_t* sim, uint32_t duration_us) {
+    mb_state_t* mb = sim->mb;
+    const uint64_t end_ns = g_sim_time_ns + 1000ULL * duration_us;
+    while (g_sim_time_ns < end_ns) {
+        if (g_sim_time_ns >= sim->next_loop_ns) {
+            NTS1::idle();
+            if (sim->loop) {
+                sim->loop(g_sim_time_ns);
+            }
+            sim_gpio_sync();
+            sim->next_loop_ns = g_sim_time_ns + 1000ULL * sim->loop_period_us;
+        }
+
+        mb_update(mb, g_sim_time_ns);
+        if (sim_ack() || !mb->honor_ack) {
+            g_sim_spi2.DR = mb_next_mosi(mb);
+            g_sim_spi_rxne = 1;
+            SPI2_IRQHandler();
+            sim_gpio_sync();
+            mb_receive(mb, (uint8_t)g_sim_spi2.DR, g_sim_time_ns);
+            ++sim->bytes;
+        } else {
+            sim->stalled_ns += SIM_BYTE_NS;
+        }
+        g_sim_time_ns += SIM_BYTE_NS;
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef SIM_SIM_H_
+#define SIM_SIM_H_
+
+#include <stdint.h>
+
+#include "main_board.h"
+
+// -- SIMULATION of the SPI link ------------------------------------------------------
+//
+// Time advances one SPI byte at a time. On every byte the main board model clocks a byte
+// out unless ACK is low, the SPI interrupt handler of lib/NTS-1 runs with it and the
+// model gets the handler's reply. The firmware main loop (nts1_idle() followed by the
+// scenario's own loop) runs every loop_period_us and takes no time. Everything is
+// deterministic, runs are repeatable.
+
+// Main board SPI byte period, 8 us for 1 Mbit/s
+#ifndef SIM_BYTE_NS
+#define SIM_BYTE_NS 8000
+#endif
+
+typedef void (*sim_loop_fn)(uint64_t time_ns);
+
+typedef struct {
+    mb_state_t* mb;
+    uint32_t loop_period_us;
+    sim_loop_fn loop;
+
+    uint64_t next_loop_ns;
+    uint64_t bytes;       // bytes clocked
+    uint64_t stalled_ns;  // time the main board held off on ACK
+} sim_state_t;
+
+// (Re)initialize lib/NTS-1 and clear its statistics, the model is left as is
+void sim_start(sim_state_t* sim, mb_state_t* mb, uint32_t loop_period_us, sim_loop_fn loop);
+void sim_run(sim_state_t* sim, uint32_t duration_us);
+
+uint64_t sim_time_ns();
+bool sim_ack();
+
+#endif  // SIM_SIM_H_
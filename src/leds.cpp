@@ -0,0 +1,89 @@
+#include "leds.h"
+
+#include <Arduino.h>
+
+static const uint8_t s_led_pins[ledCount] = {PC10, PC12, PF6, PF7, PA15, PB7, PC13, PC14};
+
+// Ports with LEDs, the port and pin mask of every LED are looked up in leds_init()
+enum { k_led_port_a = 0, k_led_port_b, k_led_port_c, k_led_port_f, k_led_port_count };
+static GPIO_TypeDef* const s_led_ports[k_led_port_count] = {GPIOA, GPIOB, GPIOC, GPIOF};
+
+static uint8_t s_led_port[ledCount];
+static uint16_t s_led_mask[ledCount];
+static uint16_t s_led_port_masks[k_led_port_count];  // every LED of the port
+
+static uint8_t s_led_levels[ledCount];
+
+// BSRR words per plane and port, double buffered. leds_show() fills the back buffer and
+// flips, the timer interrupt picks the front buffer up at the start of a frame. Calling
+// leds_show() twice within a frame can show a mix of the two for that frame only.
+typedef uint32_t led_planes_t[k_led_bits][k_led_port_count];
+static led_planes_t s_led_planes[2];
+static volatile uint8_t s_led_front;
+
+static HardwareTimer* s_led_timer;
+static uint8_t s_led_plane;                    // plane output by the next interrupt
+static const led_planes_t* s_led_frame;        // buffer of the frame being output
+
+static void leds_interrupt_handler() {
+    if (s_led_plane == 0) {
+        s_led_frame = &s_led_planes[s_led_front];
+    }
+    const uint32_t* words = (*s_led_frame)[s_led_plane];
+    GPIOA->BSRR = words[k_led_port_a];
+    GPIOB->BSRR = words[k_led_port_b];
+    GPIOC->BSRR = words[k_led_port_c];
+    GPIOF->BSRR = words[k_led_port_f];
+
+    // ARR is preloaded, the period written now follows the one that just started
+    s_led_plane = (s_led_plane + 1 < k_led_bits) ? s_led_plane + 1 : 0;
+    TIM14->ARR = (k_led_unit_us << s_led_plane) - 1;
+}
+
+void leds_set(uint8_t led, uint8_t level) {
+    s_led_levels[led] = (level < k_led_max_level) ? level : k_led_max_level;
+}
+
+void leds_show() {
+    led_planes_t* planes = &s_led_planes[s_led_front ^ 1];
+    for (uint8_t b = 0; b < k_led_bits; ++b) {
+        uint32_t* words = (*planes)[b];
+        // set wins over reset in BSRR, so start with every LED of the port reset
+        for (uint8_t p = 0; p < k_led_port_count; ++p) {
+            words[p] = (uint32_t)s_led_port_masks[p] << 16;
+        }
+        for (uint8_t i = 0; i < ledCount; ++i) {
+            if (s_led_levels[i] & (1U << b)) {
+                words[s_led_port[i]] |= s_led_mask[i];
+            }
+        }
+    }
+    s_led_front ^= 1;
+}
+
+void leds_init() {
+    for (uint8_t i = 0; i < ledCount; ++i) {
+        pinMode(s_led_pins[i], OUTPUT);
+        digitalWrite(s_led_pins[i], LOW);
+
+        const PinName pin = digitalPinToPinName(s_led_pins[i]);
+        GPIO_TypeDef* const port = get_GPIO_Port(STM_PORT(pin));
+        uint8_t p = 0;
+        while (p < k_led_port_count - 1 && s_led_ports[p] != port) {
+            ++p;
+        }
+        s_led_port[i] = p;
+        s_led_mask[i] = STM_GPIO_PIN(pin);
+        s_led_port_masks[p] |= s_led_mask[i];
+    }
+    leds_show();
+    leds_show();
+
+    // 1 MHz count, the first period is plane 0's
+    s_led_timer = new HardwareTimer(TIM14);
+    s_led_timer->setPrescaleFactor(s_led_timer->getTimerClkFreq() / 1000000);
+    s_led_timer->setOverflow(k_led_unit_us, TICK_FORMAT);
+    s_led_timer->attachInterrupt(leds_interrupt_handler);
+    TIM14->CR1 |= TIM_CR1_ARPE;
+    s_led_timer->resume();
+}
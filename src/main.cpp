@@ -1,12 +1,13 @@
 #include <Arduino.h>
 #include <nts-1.h>
-#include <quantizer.h>
-#include <quantizer_scales.h>
 
-NTS1 nts1;
+#include "leds.h"
+#include "pots.h"
+#include "seq_clock.h"
+#include "seq_store.h"
+#include "sequencer.h"
 
-using namespace braids;
-Quantizer quantizer;
+NTS1 nts1;
 
 // -- HARDWARE UI pin definitiions and state ------------------------------------------
 enum { sw_0 = 0, sw_1, sw_2, sw_3, sw_4, sw_5, sw_6, sw_7, sw_8, sw_9, sw_count };
@@ -25,84 +26,222 @@ enum {
     sw_shift = sw_9
 };
 
-enum { led0 = 0, led1, led2, led3, led4, led5, led6, led7, ledCount };
-const uint8_t g_led_pins[ledCount] = {PC10, PC12, PF6, PF7, PA15, PB7, PC13, PC14};
+// Switches are sampled by reading the input register of each of these ports once, the
+// port and bit of every switch are looked up from g_sw_pins in setup()
+enum { sw_port_a = 0, sw_port_b, sw_port_c, sw_port_f, sw_port_count };
+GPIO_TypeDef* const g_sw_ports[sw_port_count] = {GPIOA, GPIOB, GPIOC, GPIOF};
+
+typedef struct {
+    uint8_t port;   // sw_port_*
+    uint8_t shift;  // bit in the port's IDR
+} sw_bit_t;
 
-enum { pot_0 = 0, pot_count };
-const uint8_t g_pot_pins[pot_count] = {PC2};
+sw_bit_t g_sw_shuffle[sw_count];
 
 typedef struct {
     HardwareTimer* timer;
     uint32_t steps_pressed;
+    uint8_t track;  // track being edited
+    uint8_t page;   // page of the pattern on the step buttons
     bool is_shift_pressed;
+    bool is_play_pressed;
+    bool is_play_consumed;  // play was used as a modifier, don't start/stop on release
 } ui_state_t;
 
-ui_state_t g_ui_state = {.timer = NULL, .steps_pressed = 0x0, .is_shift_pressed = false};
+ui_state_t g_ui_state = {.timer = NULL,
+                         .steps_pressed = 0x0,
+                         .track = 0,
+                         .page = 0,
+                         .is_shift_pressed = false,
+                         .is_play_pressed = false,
+                         .is_play_consumed = false};
 
 // -- SEQUENCER definitions and state -------------------------------------------------
 
-#define k_seq_length 8
 #define k_seq_ticks_per_step 100
 
+// Sequencer timer scheduling. When set, a timer compare is programmed for the moment the
+// next note on/off is due and the CPU only wakes up then. Otherwise the sequencer polls
+// at k_seq_poll_hz.
+#ifndef SEQ_EVENT_DRIVEN
+#define SEQ_EVENT_DRIVEN 1
+#endif
+
+#define k_seq_timer_channel 1
+
 enum { k_seq_flag_reset = 1U << 0 };
 
 typedef struct {
     HardwareTimer* timer;
-    uint32_t last_tick_us;
+    seq_clock_t clock;      // see seq_clock.h
+    seq_clock_rate_t rate;  // clock advance per sequencer interrupt
     uint32_t ticks;
-    uint8_t step;
-    uint8_t note;
     uint8_t flags;
-    uint32_t gates;
     uint32_t tempo;
-    uint8_t notes[k_seq_length];
     bool is_playing;
 } seq_state_t;
 
+// Clock rate for a tempo in BPM x 10, worked out once per tempo change so the sequencer
+// interrupt never divides (the F030 has no hardware divider)
+static constexpr seq_clock_rate_t seq_clock_rate(uint32_t tempo) {
+#if SEQ_EVENT_DRIVEN
+    return seq_clock_event_rate(tempo);  // timer ticks to the next event
+#else
+    return seq_clock_poll_rate(tempo);  // a carry out of the remainder is one tick
+#endif
+}
+
 seq_state_t g_seq_state = {.timer = NULL,
-                           .last_tick_us = 0,
+                           .clock = {0, 0},
+                           .rate = seq_clock_rate(1200),
                            .ticks = 0xFF,  // invalid
-                           .step = 0xFF,   // invalid
-                           .note = 0xFF,   // invalid
                            .flags = 0x00,  // none
-                           .gates = 0x55,  // 1 bit per step, all on
                            .tempo = 1200,  // 120.0 x 10
-                           .notes = {0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42},
                            .is_playing = false};
 
+void seq_set_tempo(uint32_t tempo) {
+    // the clock keeps its position so tempo changes stay continuous
+    const seq_clock_rate_t rate = seq_clock_rate(tempo);
+    seq_clock_set_rate(&g_seq_state.clock, &g_seq_state.rate, &rate);
+    g_seq_state.tempo = tempo;
+}
+
+void seq_schedule_now() {
+#if SEQ_EVENT_DRIVEN
+    // fire the sequencer compare on the next couple of timer ticks
+    const uint32_t now = g_seq_state.timer->getCount(TICK_FORMAT) + 2;
+    g_seq_state.clock.count = now;
+    g_seq_state.clock.rem = 0;
+    g_seq_state.timer->setCaptureCompare(k_seq_timer_channel, now & 0xFFFF, TICK_COMPARE_FORMAT);
+#endif
+}
+
+// -- DEFERRED updates ----------------------------------------------------------------
+
+// The UI and sequencer interrupts leave NTS-1 parameter changes and LED updates to
+// loop(). Both are latest-value slots rather than queued events: an interrupt overwrites
+// the slot and loop() acts on whatever it holds when it gets there, so a burst of
+// changes coalesces into one and nothing is ever dropped. Parameter slots are the
+// parameter streams below, the LEDs have the play position and a page changed flag.
+// Notes and the parameter changes of a step are the exception, they go straight to the
+// NTS-1 realtime lane from the sequencer interrupt so their timing stays exact.
+
+// Set from either interrupt, cleared by loop() before it draws the page
+static volatile uint8_t s_page_changed;
+
+// -- PARAMETER streaming -------------------------------------------------------------
+
+// Continuous controls reach the NTS-1 through a stream per parameter. The latest value
+// goes out once the interval for the distance it has moved since the last value sent
+// has passed: a fast move is tracked closely, a slow one or jitter is sent at a lower
+// rate. The interval also stretches with the bytes queued on the realtime lane, so the
+// streams back off while notes and step frames are waiting to go out rather than
+// stopping at a fixed level. Whatever the value settles on is always sent in the end.
+#define k_stream_min_interval_us 2000   // a move of 8 or more
+#define k_stream_max_interval_us 16000  // a move of 1
+#define k_stream_tx_depth_shift 4       // every 16 realtime lane bytes queued add an interval
+
+typedef struct {
+    uint8_t param_id;
+    uint8_t param_subid;
+    volatile uint16_t value;  // latest from the control, set from interrupts
+    uint16_t sent;            // last sent, 0xFFFF before the first value
+    uint32_t last_send_us;
+} param_stream_t;
+
+param_stream_t g_param_streams[] = {
+    {k_param_id_osc_shape, k_invalid_param_subid, 0xFFFF, 0xFFFF, 0},
+};
+#define k_num_param_streams (sizeof(g_param_streams) / sizeof(g_param_streams[0]))
+
+static param_stream_t* find_param_stream(uint8_t param_id, uint8_t param_subid) {
+    for (uint8_t i = 0; i < k_num_param_streams; ++i) {
+        param_stream_t* stream = &g_param_streams[i];
+        if (stream->param_id == param_id && stream->param_subid == param_subid) {
+            return stream;
+        }
+    }
+    return NULL;
+}
+
+// Called from interrupts, every parameter changed there needs a stream
+static void post_param_change(uint8_t param_id, uint8_t param_subid, uint16_t value) {
+    param_stream_t* stream = find_param_stream(param_id, param_subid);
+    if (stream != NULL) {
+        stream->value = value;
+    }
+}
+
 // -- UI Scan/Control -----------------------------------------------------------------
 
-void set_step_leds(uint8_t mask) {
+// Step LED brightness levels, see leds.h
+#define k_led_level_gate 2
+#define k_led_level_accent 4
+#define k_led_level_play k_led_max_level  // play position on a gated step
+#define k_led_level_play_rest 1           // play position on an empty step
+
+// step with a note in flight, 0xFF between gate off and step. Set by the sequencer
+// interrupt along with s_page_changed.
+volatile uint8_t g_play_step = 0xFF;
+
+// Gates and accents of the page being edited, with the play position on top
+void show_page() {
+    const uint32_t gates = seq_engine_page_gates(g_ui_state.track, g_ui_state.page);
+    const uint32_t accents = seq_engine_page_accents(g_ui_state.track, g_ui_state.page);
+    const uint8_t play_step = g_play_step;
     for (uint8_t i = led0; i < ledCount; ++i) {
-        digitalWrite(g_led_pins[i], (mask & (1U << i)) ? HIGH : LOW);
+        const bool gate = gates & (1U << i);
+        uint8_t level = gate ? ((accents & (1U << i)) ? k_led_level_accent : k_led_level_gate) : 0;
+        if (play_step == g_ui_state.page * k_seq_page_length + i) {
+            level = gate ? k_led_level_play : k_led_level_play_rest;
+        }
+        leds_set(i, level);
     }
+    leds_show();
+}
+
+void setup_switch_shuffle() {
+    for (uint8_t i = 0; i < sw_count; ++i) {
+        const PinName pin = digitalPinToPinName(g_sw_pins[i]);
+        GPIO_TypeDef* const port = get_GPIO_Port(STM_PORT(pin));
+        uint8_t p = 0;
+        while (p < sw_port_count - 1 && g_sw_ports[p] != port) {
+            ++p;
+        }
+        g_sw_shuffle[i].port = p;
+        g_sw_shuffle[i].shift = STM_PIN(pin);
+    }
+}
+
+// Raw switch levels, bit i for sw_i. All ports are read back to back so the switches are
+// sampled together.
+static uint32_t sample_switches() {
+    const uint32_t idr[sw_port_count] = {GPIOA->IDR, GPIOB->IDR, GPIOC->IDR, GPIOF->IDR};
+    uint32_t sample = 0;
+    for (uint8_t i = 0; i < sw_count; ++i) {
+        const sw_bit_t bit = g_sw_shuffle[i];
+        sample |= ((idr[bit.port] >> bit.shift) & 0x1) << i;
+    }
+    return sample;
 }
 
 void scan_switches(unsigned long now_us) {
     static uint32_t last_sw_sample_us;
     static uint32_t last_sw_state = 0;
-    static uint8_t sw_chatter[sw_count] = {0};
+    // Vertical debounce counters, bit i of each is a bit of switch i's 3 bit count of
+    // consecutive samples that differ from its state. A switch toggles on the 7th.
+    static uint32_t sw_chatter0, sw_chatter1, sw_chatter2;
 
     if (now_us - last_sw_sample_us > 1000) {
-        // read in switch values
-        uint32_t sw_state = 0;
-        for (uint8_t i = 0; i < sw_count; ++i) {
-            const uint32_t val = digitalRead(g_sw_pins[i]);
-            const uint32_t lastVal = ((last_sw_state >> i) & 0x1);
-            if (val != lastVal) {
-                if (++sw_chatter[i] > 6) {
-                    // toggle value and reset chatter counter
-                    sw_state |= val << i;
-                    sw_chatter[i] = 0;
-                } else {
-                    // keep current value
-                    sw_state |= lastVal << i;
-                }
-            } else {
-                sw_chatter[i] = 0;
-                sw_state |= lastVal << i;
-            }
-        }
+        const uint32_t delta = sample_switches() ^ last_sw_state;
+        sw_chatter2 = (sw_chatter2 ^ (sw_chatter1 & sw_chatter0)) & delta;
+        sw_chatter1 = (sw_chatter1 ^ sw_chatter0) & delta;
+        sw_chatter0 = ~sw_chatter0 & delta;
+        const uint32_t toggled = sw_chatter2 & sw_chatter1 & sw_chatter0;
+        sw_chatter2 &= ~toggled;
+        sw_chatter1 &= ~toggled;
+        sw_chatter0 &= ~toggled;
+        const uint32_t sw_state = last_sw_state ^ toggled;
 
         // change detected?
         if (last_sw_state != sw_state) {
@@ -113,10 +252,27 @@ void scan_switches(unsigned long now_us) {
             if (sw_events & k_play_sw_mask) {
                 if ((~sw_state) & k_play_sw_mask) {
                     // pressed down
-                    // reset sequencer
-                    g_seq_state.flags |= k_seq_flag_reset;
-                    // toggle play state
-                    g_seq_state.is_playing = !g_seq_state.is_playing;
+                    g_ui_state.is_play_pressed = true;
+                    if (g_ui_state.is_shift_pressed) {
+                        // shift + play, edit next track
+                        g_ui_state.track = (g_ui_state.track + 1) % k_seq_num_tracks;
+                        s_page_changed = 1;
+                        g_ui_state.is_play_consumed = true;
+                    } else {
+                        // start/stop on release unless used as a modifier meanwhile
+                        g_ui_state.is_play_consumed = g_ui_state.steps_pressed != 0;
+                    }
+                } else {
+                    // released
+                    g_ui_state.is_play_pressed = false;
+                    if (!g_ui_state.is_play_consumed) {
+                        // reset sequencer
+                        g_seq_state.flags |= k_seq_flag_reset;
+                        // toggle play state
+                        g_seq_state.is_playing = !g_seq_state.is_playing;
+                        // handle it right away rather than on the next scheduled event
+                        seq_schedule_now();
+                    }
                 }
             }
 
@@ -124,6 +280,23 @@ void scan_switches(unsigned long now_us) {
             static const uint32_t k_shift_sw_mask = (1U << sw_shift);
             if (sw_events & k_shift_sw_mask) {
                 g_ui_state.is_shift_pressed = (sw_state & k_shift_sw_mask) == 0;  // active low
+                if (g_ui_state.is_shift_pressed && !g_ui_state.steps_pressed &&
+                    g_ui_state.is_play_pressed) {
+                    // play + shift, save every pattern to flash
+                    seq_store_save();
+                    g_ui_state.is_play_consumed = true;
+                } else if (g_ui_state.is_shift_pressed && g_ui_state.steps_pressed) {
+                    if (g_ui_state.is_play_pressed) {
+                        // step(s) + play + shift, clear parameter locks of held steps
+                        seq_engine_clear_locks(g_ui_state.page,
+                                               g_ui_state.steps_pressed >> sw_step0);
+                    } else {
+                        // step(s) + shift, cycle accent/tie of held steps
+                        seq_engine_cycle_articulation(g_ui_state.track, g_ui_state.page,
+                                                      g_ui_state.steps_pressed >> sw_step0);
+                        s_page_changed = 1;
+                    }
+                }
             }
 
             // check for step switch events
@@ -133,10 +306,24 @@ void scan_switches(unsigned long now_us) {
                 const uint32_t new_presses = (~sw_state) & step_sw_events;
                 const uint32_t released = sw_state & step_sw_events;
 
-                if (g_ui_state.is_shift_pressed) {
+                if (g_ui_state.is_play_pressed && new_presses) {
+                    // play + step selects a page, play + shift + step queues a pattern
+                    uint8_t idx = 0;
+                    while (!(new_presses & (1U << (sw_step0 + idx)))) {
+                        ++idx;
+                    }
+                    if (g_ui_state.is_shift_pressed) {
+                        seq_engine_queue_pattern(idx);
+                    } else {
+                        g_ui_state.page = idx;
+                        s_page_changed = 1;
+                    }
+                    g_ui_state.is_play_consumed = true;
+                } else if (g_ui_state.is_shift_pressed) {
                     // set/unset sequencer gates
-                    g_seq_state.gates ^= new_presses >> sw_step0;
-                    set_step_leds(g_seq_state.gates);
+                    seq_engine_toggle_gates(g_ui_state.track, g_ui_state.page,
+                                            new_presses >> sw_step0);
+                    s_page_changed = 1;
                 }
 
                 g_ui_state.steps_pressed |= new_presses;
@@ -150,124 +337,130 @@ void scan_switches(unsigned long now_us) {
 }
 
 void handle_pot_0(int16_t value) {
-    static int32_t last_tempo_pot_val = 0xFFFFFFFF;
-    static int32_t last_shape_pot_val = 0xFFFFFFFF;
-
-    if (g_ui_state.steps_pressed) {
-        // set note if a step button is currently pressed
-        uint8_t note = value >> 3;  /// 10 bit ADC to 7 bit note value
-        for (uint8_t i = sw_step0; i <= sw_step7; ++i) {
-            // only effect selected (pressed) notes
-            if (g_ui_state.steps_pressed & (1U << i)) {
-                g_seq_state.notes[i] = note;
-            }
-        }
+    if (g_ui_state.steps_pressed && g_ui_state.is_play_pressed) {
+        // lock SHAPE on the pressed steps when play is held too
+        seq_engine_set_locks(g_ui_state.page, g_ui_state.steps_pressed >> sw_step0,
+                             k_param_id_osc_shape, value);
+    } else if (g_ui_state.steps_pressed) {
+        // set note (or parameter value) if a step button is currently pressed
+        const uint8_t note = value >> 3;  /// 10 bit ADC to 7 bit note value
+        seq_engine_set_values(g_ui_state.track, g_ui_state.page,
+                              g_ui_state.steps_pressed >> sw_step0, note);
+    } else if (g_ui_state.is_play_pressed) {
+        // change pattern length when play is held, 1 - 64 steps
+        seq_engine_set_length(1 + (value >> 4));
+        g_ui_state.is_play_consumed = true;
     } else if (g_ui_state.is_shift_pressed) {
-        // change tempo when shift is pressed
-        if (last_tempo_pot_val == 0xFFFFFFFF || (abs(value - last_tempo_pot_val) > 10)) {
-            // 4 - 260 BPM in 0.5 increments
-            g_seq_state.tempo = 40 + (value >> 1) * 5 + (value & 0x1) * 5;
-            last_tempo_pot_val = value;
-        }
+        // change tempo when shift is pressed, 4 - 260 BPM in 0.5 increments
+        seq_set_tempo(40 + (value >> 1) * 5 + (value & 0x1) * 5);
     } else {
         // Change SHAPE by default
-        if (last_shape_pot_val == 0xFFFFFFFF || (abs(value - last_shape_pot_val) > 10)) {
-            nts1.paramChange(k_param_id_osc_shape, k_invalid_param_subid, value);
-            last_shape_pot_val = value;
-        }
+        post_param_change(k_param_id_osc_shape, k_invalid_param_subid, value);
     }
 }
 
-void scan_pots(unsigned long now_us) {
-    static uint32_t last_pot_sample_us = 0;
-    static uint32_t last_pot_states[pot_count] = {0};
-    static uint8_t pot_chatter[pot_count] = {0};
-
-    if (now_us - last_pot_sample_us > 1000) {
-        for (uint8_t i = 0; i < pot_count; ++i) {
-            int32_t pot_state = 0;
-            const int32_t val = analogRead(g_pot_pins[i]);
-            const int32_t last_val = last_pot_states[i];
-            if (val != last_val) {
-                if (++pot_chatter[i] > 4) {
-                    pot_state = val;
-                    pot_chatter[i] = 0;
-                } else {
-                    pot_state = last_val;
-                }
-            } else {
-                pot_chatter[i] = 0;
-                pot_state = last_val;
-            }
-
-            if (last_val == pot_state) {
-                last_pot_sample_us = now_us;
-                continue;
-            }
-
-            switch (i) {
-                case pot_0:
-                    handle_pot_0(pot_state & 0x3FF);
-                    break;
-                default:
-                    break;
-            }
-
-            last_pot_states[i] = pot_state;
+// Pots are handled as 10 bit positions. A position only changes once the filtered value
+// is more than k_pot_hysteresis past the edges of its step, so a pot resting on an edge
+// doesn't flicker between two positions.
+#define k_pot_position_shift 6  // 16 bit filtered value to 10 bit position
+#define k_pot_hysteresis ((1 << k_pot_position_shift) / 2)
+
+void scan_pots() {
+    static uint16_t pot_positions[pot_count] = {0};
+
+    for (uint8_t i = 0; i < pot_count; ++i) {
+        const int32_t value = pot_value(i);
+        const int32_t low = (pot_positions[i] << k_pot_position_shift) - k_pot_hysteresis;
+        const int32_t high = ((pot_positions[i] + 1) << k_pot_position_shift) + k_pot_hysteresis;
+        if (value >= low && value < high) {
+            continue;
+        }
+        pot_positions[i] = value >> k_pot_position_shift;
+
+        switch (i) {
+            case pot_0:
+                handle_pot_0(pot_positions[i]);
+                break;
+            default:
+                break;
         }
-        last_pot_sample_us = now_us;
     }
 }
 
 void scan_interrupt_handler(void) {
     unsigned long us = micros();
     scan_switches(us);
-    scan_pots(us);
+    scan_pots();
 }
 
 // -- SEQUENCER Runtime ---------------------------------------------------------------
 
-// NOTE: Pitches are bit shifted 7 positions for accurracy
+static void seq_show_play_step(uint8_t step) {
+    g_play_step = step;
+    s_page_changed = 1;
+}
 
-int32_t note_to_pitch(uint8_t noteNumber) {
-    return 440.0 * std::pow(2.0, ((double)noteNumber - 69) / 12.0);
-    //  * 128;
+static void seq_gate_off() {
+    // send note off events to NTS-1
+    seq_engine_gate_off();
+    seq_show_play_step(0xFF);
 }
 
-uint8_t pitch_to_note(uint32_t pitch) {
-    // n  =  12*log2(fn/440 Hz).
-    // return 12 * std::log2((pitch / (440 << 7) >> 7));
-    return 12 * std::log2((double)pitch / 440.0) + 69;
+static void seq_next_step() {
+    // send note on / parameter change events to NTS-1
+    seq_show_play_step(seq_engine_next_step());
 }
 
+static void seq_reset() {
+    // there may be pending note ons, send note offs
+    seq_show_play_step(0xFF);
+    seq_engine_rewind();
+    g_seq_state.ticks = 0xFF;
+    g_seq_state.flags &= ~k_seq_flag_reset;
+}
+
+#if SEQ_EVENT_DRIVEN
+
 void seq_interrupt_handler() {
-    uint32_t now_us = micros();
+    if (g_seq_state.flags & k_seq_flag_reset) {
+        seq_reset();
+    }
+
+    if (!g_seq_state.is_playing) {
+        // no further events until play is pressed
+        return;
+    }
+
+    // schedule the following event, the remainder carries over so the schedule does not
+    // drift, and the count wraps along with the 16 bit counter
+    seq_clock_advance(&g_seq_state.clock, &g_seq_state.rate);
+    g_seq_state.timer->setCaptureCompare(k_seq_timer_channel, g_seq_state.clock.count & 0xFFFF,
+                                         TICK_COMPARE_FORMAT);
 
+    // events alternate between step start (note on) and half way through step (note off)
+    if (g_seq_state.ticks >= (k_seq_ticks_per_step >> 1)) {
+        g_seq_state.ticks = 0;
+        seq_next_step();
+    } else {
+        g_seq_state.ticks = k_seq_ticks_per_step >> 1;
+        seq_gate_off();
+    }
+}
+
+#else
+
+void seq_interrupt_handler() {
     if (g_seq_state.flags & k_seq_flag_reset) {
-        if (g_seq_state.note != 0xFF) {
-            // there's a pending note on, send note off
-            nts1.noteOff(g_seq_state.note);
-            const uint32_t cur_step = g_seq_state.step;
-            const uint8_t highlow =
-                (g_seq_state.gates & (1U << cur_step)) ? HIGH : LOW;  // revert LEDs
-            digitalWrite(g_led_pins[cur_step], highlow);
-        }
-        // reset sequencer
-        g_seq_state.ticks = 0xFF;
-        g_seq_state.step = 0xFF;
-        g_seq_state.note = 0xFF;
-        g_seq_state.last_tick_us = now_us;
-        g_seq_state.flags &= ~k_seq_flag_reset;
+        seq_reset();
+        g_seq_state.clock.rem = 0;
     }
 
     if (!g_seq_state.is_playing) {
         return;
     }
 
-    // have we counted another tick?
-    const uint32_t us_per_tick = 600000000UL / (4 * g_seq_state.tempo * 100);
-    const uint32_t tick_delta_us = now_us - g_seq_state.last_tick_us;
-    if (tick_delta_us < us_per_tick) {
+    // have we counted another tick? (carry out of the clock remainder)
+    if (!seq_clock_advance(&g_seq_state.clock, &g_seq_state.rate)) {
         // still counting up current tick
         return;
     }
@@ -275,50 +468,18 @@ void seq_interrupt_handler() {
     // increment tick
     ++g_seq_state.ticks;
 
-    // set adjusted reference time for next tick (keeping any extra time)
-    g_seq_state.last_tick_us = now_us - (tick_delta_us - us_per_tick);
-
-    uint32_t cur_step = g_seq_state.step;
-
     if (g_seq_state.ticks >= k_seq_ticks_per_step) {
         // increment step
-        cur_step = (cur_step + 1) % k_seq_length;
         g_seq_state.ticks = 0;
-
-        uint8_t note = g_seq_state.notes[cur_step];
-        // quantize note on fly so we can change scales quickly
-        // braids is looking for a pitch, not a MIDI note
-        // TODO: convert internally to pitch values
-        int32_t pitch = note_to_pitch(note);
-        pitch = quantizer.Process(pitch, 60 << 7);
-        note = pitch_to_note(pitch);
-
-        if (g_seq_state.gates & (1U << cur_step)) {
-            // send note on event to NTS-1
-            nts1.noteOn(note, 0x7F);
-            digitalWrite(g_led_pins[cur_step], LOW);
-        } else {
-            digitalWrite(g_led_pins[cur_step], HIGH);
-        }
-
-        g_seq_state.step = cur_step;
-        g_seq_state.note = note;
-
+        seq_next_step();
     } else if (g_seq_state.ticks >= (k_seq_ticks_per_step >> 1)) {
         // half way through step
-        if (g_seq_state.note != 0xFF) {
-            // send note off event to NTS-1
-            nts1.noteOff(g_seq_state.note);
-            g_seq_state.note = 0xFF;
-
-            // revert LED
-            uint32_t cur_step = g_seq_state.step;
-            const uint8_t highlow = (g_seq_state.gates & (1U << cur_step)) ? HIGH : LOW;
-            digitalWrite(g_led_pins[cur_step], highlow);
-        }
+        seq_gate_off();
     }
 }
 
+#endif
+
 // -- HARDWARE Timer Setup ------------------------------------------------------------
 
 HardwareTimer* setup_timer(TIM_TypeDef* timer, uint32_t refresh_hz, void (*interrupt_handler)()) {
@@ -328,6 +489,61 @@ HardwareTimer* setup_timer(TIM_TypeDef* timer, uint32_t refresh_hz, void (*inter
     return tim;
 }
 
+HardwareTimer* setup_compare_timer(TIM_TypeDef* timer, uint32_t tick_hz, uint32_t channel,
+                                   void (*interrupt_handler)()) {
+    HardwareTimer* tim = new HardwareTimer(timer);
+    tim->setPrescaleFactor(tim->getTimerClkFreq() / tick_hz);
+    tim->setOverflow(0x10000, TICK_FORMAT);  // free running 16 bit counter
+    tim->setMode(channel, TIMER_OUTPUT_COMPARE);
+    tim->setCaptureCompare(channel, 0xFFFF, TICK_COMPARE_FORMAT);
+    tim->attachInterrupt(channel, interrupt_handler);
+    return tim;
+}
+
+// -- PARAMETER stream handling -----------------------------------------------------
+
+static void run_param_streams(uint32_t now_us) {
+    nts1_tx_lane_stats_t lane;
+    NTS1::getTxLaneStats(NTS1::LANE_REALTIME, &lane);
+
+    for (uint8_t i = 0; i < k_num_param_streams; ++i) {
+        param_stream_t* stream = &g_param_streams[i];
+        const uint16_t value = stream->value;
+        if (value == stream->sent) {
+            continue;
+        }
+        // halve the interval for every doubling of the distance
+        uint32_t interval_us = k_stream_max_interval_us;
+        if (stream->sent != 0xFFFF) {
+            const uint16_t distance = abs(value - stream->sent);
+            for (uint16_t d = distance; d > 1 && interval_us > k_stream_min_interval_us; d >>= 1) {
+                interval_us >>= 1;
+            }
+            interval_us += (interval_us * lane.depth) >> k_stream_tx_depth_shift;
+        } else {
+            interval_us = 0;
+        }
+        if (now_us - stream->last_send_us < interval_us) {
+            continue;
+        }
+        // kept for the next loop() if the NTS-1 interface is backed up
+        if (nts1.paramChange(stream->param_id, stream->param_subid, value) == NTS1::STATUS_OK) {
+            stream->sent = value;
+            stream->last_send_us = now_us;
+        }
+    }
+}
+
+// -- DEFERRED update handling --------------------------------------------------------
+
+static void run_page_update() {
+    // cleared first, a change posted while the page is drawn shows it again
+    if (s_page_changed) {
+        s_page_changed = 0;
+        show_page();
+    }
+}
+
 // -- MAIN ----------------------------------------------------------------------------
 
 void setup() {
@@ -335,27 +551,40 @@ void setup() {
     for (uint8_t i = 0; i < sw_count; ++i) {
         pinMode(g_sw_pins[i], INPUT_PULLUP);
     }
-    for (uint8_t i = 0; i < ledCount; ++i) {
-        pinMode(g_led_pins[i], OUTPUT);
-    }
+    setup_switch_shuffle();
+    leds_init();
 
-    nts1.init();
-    quantizer.Init();
+    // start sampling the pots in the background
+    pots_init();
 
-    quantizer.Configure(scales[2]);
+    nts1.init();
+    NTS1::catalogInit();
+    seq_engine_init();
+    seq_store_load();
 
     // init UI state
-    set_step_leds(g_seq_state.gates);
+    show_page();
 
     // setup hardware timer for switch/pot scanning
     g_ui_state.timer = setup_timer(TIM1, 200, scan_interrupt_handler);
 
     // setup hardware timer for sequencer
-    g_seq_state.timer = setup_timer(TIM3, 20000, seq_interrupt_handler);
+#if SEQ_EVENT_DRIVEN
+    g_seq_state.timer =
+        setup_compare_timer(TIM3, k_seq_timer_hz, k_seq_timer_channel, seq_interrupt_handler);
+#else
+    g_seq_state.timer = setup_timer(TIM3, k_seq_poll_hz, seq_interrupt_handler);
+#endif
 
     // start timers
     g_ui_state.timer->resume();
     g_seq_state.timer->resume();
 }
 
-void loop() { nts1.idle(); }
\ No newline at end of file
+void loop() {
+    run_page_update();
+    run_param_streams(micros());
+    nts1.idle();
+    NTS1::catalogIdle();
+    seq_store_idle();
+}
\ No newline at end of file
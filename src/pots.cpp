@@ -0,0 +1,94 @@
+#include "pots.h"
+
+#include <Arduino.h>
+
+// ADC channels in ascending order, the ADC scans selected channels by channel number
+static const uint8_t s_pot_pins[pot_count] = {PC2};
+static const uint32_t s_pot_channels = ADC_CHSELR_CHSEL12;  // PC2
+
+#define k_pot_dma_irq_priority 2  // below the NTS-1 SPI link
+
+// Two halves of k_pot_oversampling conversions of every pot, interleaved by pot
+static volatile uint16_t s_pot_samples[2][k_pot_oversampling][pot_count];
+
+// IIR state in 16.8 fixed point, only touched by the DMA interrupt
+static int32_t s_pot_iir[pot_count];
+static bool s_pot_primed;
+
+// Latest filtered values, 16 bit so readers never see a torn value
+static volatile uint16_t s_pot_values[pot_count];
+
+uint16_t pot_value(uint8_t pot) { return s_pot_values[pot]; }
+
+static void pots_filter(volatile uint16_t (*half)[pot_count]) {
+    for (uint8_t p = 0; p < pot_count; ++p) {
+        uint32_t sum = 0;
+        for (uint8_t i = 0; i < k_pot_oversampling; ++i) {
+            sum += half[i][p];
+        }
+        const int32_t target = (int32_t)(sum << 8);
+        if (!s_pot_primed) {
+            s_pot_iir[p] = target;  // start where the pot is rather than ramp up from 0
+        }
+        s_pot_iir[p] += (target - s_pot_iir[p]) >> k_pot_iir_shift;
+        s_pot_values[p] = s_pot_iir[p] >> 8;
+    }
+    s_pot_primed = true;
+}
+
+extern "C" void DMA1_Channel1_IRQHandler(void) {
+    const uint32_t isr = DMA1->ISR;
+    DMA1->IFCR = isr & (DMA_ISR_GIF1 | DMA_ISR_HTIF1 | DMA_ISR_TCIF1);
+    if (isr & DMA_ISR_HTIF1) {
+        pots_filter(s_pot_samples[0]);
+    }
+    if (isr & DMA_ISR_TCIF1) {
+        pots_filter(s_pot_samples[1]);
+    }
+}
+
+void pots_init() {
+    for (uint8_t i = 0; i < pot_count; ++i) {
+        pinMode(s_pot_pins[i], INPUT_ANALOG);
+    }
+
+    __HAL_RCC_ADC1_CLK_ENABLE();
+    __HAL_RCC_DMA1_CLK_ENABLE();
+    __HAL_RCC_TIM15_CLK_ENABLE();
+
+    // ADC clocked by PCLK / 2, calibrated while still disabled
+    ADC1->CFGR2 = ADC_CFGR2_CKMODE_0;
+    ADC1->CR = ADC_CR_ADCAL;
+    while (ADC1->CR & ADC_CR_ADCAL) {
+    }
+
+    // ADC -> sample buffer, wraps around forever
+    DMA1_Channel1->CCR = 0;
+    DMA1_Channel1->CPAR = (uint32_t)&ADC1->DR;
+    DMA1_Channel1->CMAR = (uint32_t)s_pot_samples;
+    DMA1_Channel1->CNDTR = sizeof(s_pot_samples) / sizeof(uint16_t);
+    DMA1_Channel1->CCR = DMA_CCR_MINC | DMA_CCR_PSIZE_0 | DMA_CCR_MSIZE_0 | DMA_CCR_CIRC |
+                         DMA_CCR_HTIE | DMA_CCR_TCIE | DMA_CCR_EN;
+    HAL_NVIC_SetPriority(DMA1_Channel1_IRQn, k_pot_dma_irq_priority, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Channel1_IRQn);
+
+    // Every pot converted on the rising edge of TIM15 TRGO, the longest sampling time
+    // suits the pots' source impedance and still fits the trigger period many times
+    ADC1->CFGR1 = ADC_CFGR1_DMAEN | ADC_CFGR1_DMACFG | ADC_CFGR1_OVRMOD | ADC_CFGR1_EXTEN_0 |
+                  ADC_CFGR1_EXTSEL_2;
+    ADC1->SMPR = ADC_SMPR_SMP;
+    ADC1->CHSELR = s_pot_channels;
+    ADC1->ISR = ADC_ISR_ADRDY;
+    ADC1->CR = ADC_CR_ADEN;
+    while (!(ADC1->ISR & ADC_ISR_ADRDY)) {
+    }
+    ADC1->CR |= ADC_CR_ADSTART;
+
+    // TIM15 update at k_pot_sample_hz as TRGO
+    TIM15->CR1 = 0;
+    TIM15->PSC = HAL_RCC_GetPCLK1Freq() / 1000000 - 1;  // 1 MHz count
+    TIM15->ARR = 1000000 / k_pot_sample_hz - 1;
+    TIM15->CR2 = TIM_CR2_MMS_1;
+    TIM15->EGR = TIM_EGR_UG;
+    TIM15->CR1 = TIM_CR1_CEN;
+}
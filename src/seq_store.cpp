@@ -0,0 +1,133 @@
+#include "seq_store.h"
+
+#include <Arduino.h>
+#include <nts-1.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "sequencer.h"
+
+#define k_seq_store_magic 0x4E535131UL  // "NSQ1"
+
+typedef struct {
+    uint16_t pattern_size;  // sizeof(seq_pattern_t)
+    uint16_t num_patterns;
+    uint32_t magic;  // programmed last, the bank is valid once it reads back
+} seq_store_header_t;
+
+#define k_seq_store_size (sizeof(seq_store_header_t) + sizeof(g_seq_patterns))
+
+// Whole pages right below the NTS-1 unit catalog, platformio.ini keeps the image clear
+// of both
+#define k_seq_store_pages ((k_seq_store_size + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE)
+#define k_seq_store_addr (NTS1_CATALOG_FLASH_ADDR - k_seq_store_pages * FLASH_PAGE_SIZE)
+
+#define k_seq_store_header ((const seq_store_header_t*)k_seq_store_addr)
+#define k_seq_store_patterns (k_seq_store_addr + sizeof(seq_store_header_t))
+
+static_assert(sizeof(g_seq_patterns) % 2 == 0, "patterns are programmed in half words");
+static_assert(k_seq_store_chunk % 2 == 0, "chunks are programmed in half words");
+
+enum {
+    k_seq_store_state_idle = 0,
+    k_seq_store_state_erase,    // page s_page left to erase
+    k_seq_store_state_program,  // patterns from s_offset left to program
+    k_seq_store_state_commit,   // header left to program
+};
+
+static uint8_t s_state;
+static uint8_t s_page;
+static uint16_t s_offset;
+
+// Set by seq_store_save(), which may run in an interrupt, picked up by seq_store_idle()
+static volatile uint8_t s_save_requested;
+
+bool seq_store_load() {
+    const seq_store_header_t* header = k_seq_store_header;
+    if (header->magic != k_seq_store_magic || header->pattern_size != sizeof(seq_pattern_t) ||
+        header->num_patterns != k_seq_num_patterns) {
+        return false;
+    }
+    // a bank that does not hold together keeps the defaults from seq_engine_init()
+    const seq_pattern_t* patterns = (const seq_pattern_t*)k_seq_store_patterns;
+    for (uint8_t i = 0; i < k_seq_num_patterns; ++i) {
+        if (!seq_engine_check_pattern(&patterns[i])) {
+            return false;
+        }
+    }
+    memcpy(g_seq_patterns, (const void*)k_seq_store_patterns, sizeof(g_seq_patterns));
+    return true;
+}
+
+void seq_store_save() { s_save_requested = 1; }
+
+static void seq_store_set_state(uint8_t state) {
+    // edits would tear patterns programmed over several calls, they wait for the commit
+    seq_engine_hold_edits(state == k_seq_store_state_program ||
+                          state == k_seq_store_state_commit);
+    s_state = state;
+}
+
+void seq_store_idle() {
+    if (s_save_requested) {
+        s_save_requested = 0;
+        seq_store_set_state(k_seq_store_state_erase);
+        s_page = 0;
+    }
+
+    switch (s_state) {
+        case k_seq_store_state_erase:
+            if (NTS1::flashBegin()) {
+                if (NTS1::flashErase(k_seq_store_addr + s_page * FLASH_PAGE_SIZE, 1)) {
+                    if (++s_page == k_seq_store_pages) {
+                        seq_store_set_state(k_seq_store_state_program);
+                        s_offset = 0;
+                    }
+                } else {
+                    s_page = 0;
+                }
+                NTS1::flashEnd();
+            }
+            break;
+        case k_seq_store_state_program:
+            if (NTS1::flashBegin()) {
+                const uint16_t left = sizeof(g_seq_patterns) - s_offset;
+                const uint16_t size = (left < k_seq_store_chunk) ? left : k_seq_store_chunk;
+                if (NTS1::flashProgram(k_seq_store_patterns + s_offset,
+                                       (const uint8_t*)g_seq_patterns + s_offset, size)) {
+                    s_offset += size;
+                    if (s_offset == sizeof(g_seq_patterns)) {
+                        seq_store_set_state(k_seq_store_state_commit);
+                    }
+                } else {
+                    seq_store_set_state(k_seq_store_state_erase);
+                    s_page = 0;
+                }
+                NTS1::flashEnd();
+            }
+            break;
+        case k_seq_store_state_commit:
+            if (NTS1::flashBegin()) {
+                const seq_store_header_t header = {
+                    .pattern_size = sizeof(seq_pattern_t),
+                    .num_patterns = k_seq_num_patterns,
+                    .magic = k_seq_store_magic,
+                };
+                // the magic goes last
+                const uint16_t magic_offset = offsetof(seq_store_header_t, magic);
+                if (NTS1::flashProgram(k_seq_store_addr, &header, magic_offset) &&
+                    NTS1::flashProgram(k_seq_store_addr + magic_offset, &header.magic,
+                                       sizeof(header.magic))) {
+                    seq_store_set_state(k_seq_store_state_idle);
+                } else {
+                    seq_store_set_state(k_seq_store_state_erase);
+                    s_page = 0;
+                }
+                NTS1::flashEnd();
+            }
+            break;
+        case k_seq_store_state_idle:
+        default:
+            break;
+    }
+}
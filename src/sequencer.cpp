@@ -0,0 +1,438 @@
+#include "sequencer.h"
+
+#include <Arduino.h>
+#include <nts-1.h>
+#include <quantizer.h>
+#include <quantizer_scales.h>
+#include <string.h>
+
+#include "seq_pitch.h"
+
+using namespace braids;
+static Quantizer s_quantizer;
+
+// note track followed by parameter tracks
+seq_tracks_t g_seq_tracks = {
+    .kind = {k_seq_track_kind_note, k_seq_track_kind_param, k_seq_track_kind_param,
+             k_seq_track_kind_param},
+    .param_id = {NTS1::PARAM_ID_INVALID, k_param_id_filt_cutoff, k_param_id_filt_peak,
+                 k_param_id_del_mix},
+    .notes = {0xFF, 0xFF, 0xFF, 0xFF},
+    .notes_on = 0x0,
+    .pattern = 0,
+    .step = 0xFF,  // invalid
+    .queue = {0},
+    .queue_ridx = 0,
+    .queue_widx = 0};
+
+seq_pattern_t g_seq_patterns[k_seq_num_patterns];
+
+static volatile bool s_edits_held;
+
+#define k_seq_velocity 0x64
+#define k_seq_accent_velocity 0x7F
+
+// A step goes out as a single frame: parameter changes (param tracks, then locks) first
+// so they apply to the note on that follows
+#define k_seq_frame_params (k_seq_num_tracks + k_seq_max_step_locks)
+#define k_seq_frame_events (2 * k_seq_num_tracks)  // note on + note off of a tie
+
+typedef struct {
+    nts1_tx_param_change_t params[k_seq_frame_params];
+    nts1_tx_event_t events[k_seq_frame_events];
+    uint8_t num_params;
+    uint8_t num_events;
+} seq_frame_t;
+
+static_assert(k_seq_num_tracks <= 8, "tracks must fit the per step masks");
+static_assert(k_seq_max_length <= 64, "steps must fit the lock step bits");
+static_assert(sizeof(seq_lock_t) == 3, "locks are packed");
+static_assert((k_seq_queue_length & (k_seq_queue_length - 1)) == 0, "queue size power of 2");
+
+// -- Bit-packed step values ------------------------------------------------------------
+
+static inline uint8_t seq_value_get(const uint8_t* values, uint8_t step) {
+    const uint32_t bit = step * k_seq_value_bits;
+    const uint32_t word = values[bit >> 3] | (values[(bit >> 3) + 1] << 8);
+    return (word >> (bit & 0x7)) & 0x7F;
+}
+
+static inline void seq_value_set(uint8_t* values, uint8_t step, uint8_t value) {
+    const uint32_t bit = step * k_seq_value_bits;
+    const uint32_t idx = bit >> 3;
+    uint32_t word = values[idx] | (values[idx + 1] << 8);
+    word &= ~(0x7FU << (bit & 0x7));
+    word |= (value & 0x7FU) << (bit & 0x7);
+    values[idx] = word & 0xFF;
+    values[idx + 1] = word >> 8;
+}
+
+// -- Per step track masks ------------------------------------------------------------
+
+#define k_seq_mask_all ((1U << k_seq_mask_bits) - 1)
+
+static inline uint8_t seq_mask_get(const uint8_t* masks, uint8_t step) {
+    const uint32_t bit = step * k_seq_mask_bits;
+    return (masks[bit >> 3] >> (bit & 0x7)) & k_seq_mask_all;
+}
+
+static inline void seq_mask_toggle(uint8_t* masks, uint8_t step, uint8_t tracks) {
+    const uint32_t bit = step * k_seq_mask_bits;
+    masks[bit >> 3] ^= tracks << (bit & 0x7);
+}
+
+// -- Frames ----------------------------------------------------------------------------
+
+static void seq_frame_param(seq_frame_t* frame, uint8_t param_id, uint16_t value) {
+    if (param_id >= k_num_param_id) {
+        return;
+    }
+    uint8_t i = 0;
+    while (i < frame->num_params && frame->params[i].param_id != param_id) {
+        ++i;
+    }
+    // unchanged values are not sent again, a later change of the same parameter (a lock
+    // over a param track) replaces the earlier one or takes it out of the frame
+    const bool unchanged = NTS1::getParamValue(param_id, k_invalid_param_subid) == value;
+    if (i < frame->num_params && unchanged) {
+        --frame->num_params;
+        memmove(&frame->params[i], &frame->params[i + 1],
+                (frame->num_params - i) * sizeof(nts1_tx_param_change_t));
+        return;
+    }
+    if (unchanged || i == k_seq_frame_params) {
+        return;
+    }
+    nts1_tx_param_change_t* param = &frame->params[i];
+    param->param_id = param_id;
+    param->param_subid = k_invalid_param_subid;
+    param->msb = (value >> 7) & 0x7F;
+    param->lsb = value & 0x7F;
+    if (i == frame->num_params) {
+        ++frame->num_params;
+    }
+}
+
+static void seq_frame_event(seq_frame_t* frame, uint8_t event_id, uint8_t note, uint8_t velo) {
+    nts1_tx_event_t* event = &frame->events[frame->num_events++];
+    event->event_id = event_id;
+    event->msb = note & 0x7F;
+    event->lsb = velo & 0x7F;
+}
+
+static uint8_t seq_frame_send(const seq_frame_t* frame) {
+    if (!frame->num_params && !frame->num_events) {
+        return NTS1::STATUS_OK;
+    }
+    return NTS1::sendFrame(frame->params, frame->num_params, frame->events, frame->num_events);
+}
+
+// -- Parameter locks -------------------------------------------------------------------
+
+static inline uint8_t seq_lock_step(const seq_lock_t* lock) { return lock->step_msb & 0x3F; }
+
+static inline uint16_t seq_lock_value(const seq_lock_t* lock) {
+    return ((lock->step_msb & 0xC0) << 2) | lock->lsb;
+}
+
+static inline seq_lock_t seq_lock_make(uint8_t step, uint8_t param_id, uint16_t value) {
+    return {(uint8_t)((step & 0x3F) | ((value >> 2) & 0xC0)), param_id, (uint8_t)value};
+}
+
+static inline bool seq_step_is_locked(const seq_pattern_t* pattern, uint8_t step) {
+    return pattern->locked[step >> 3] & (1U << (step & 0x7));
+}
+
+// Index of the first lock at or after step
+static uint8_t seq_lock_find(const seq_pattern_t* pattern, uint8_t step) {
+    uint8_t lo = 0;
+    uint8_t hi = pattern->num_locks;
+    while (lo < hi) {
+        const uint8_t mid = (lo + hi) >> 1;
+        if (seq_lock_step(&pattern->locks[mid]) < step) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void seq_lock_set(seq_pattern_t* pattern, uint8_t step, uint8_t param_id,
+                         uint16_t value) {
+    uint8_t idx = seq_lock_find(pattern, step);
+    uint8_t count = 0;
+    for (; idx < pattern->num_locks && seq_lock_step(&pattern->locks[idx]) == step;
+         ++idx, ++count) {
+        if (pattern->locks[idx].param_id == param_id) {
+            pattern->locks[idx] = seq_lock_make(step, param_id, value);
+            return;
+        }
+    }
+    if (pattern->num_locks == k_seq_max_locks || count == k_seq_max_step_locks) {
+        return;
+    }
+    // insert after the step's other locks to keep the pool sorted
+    memmove(&pattern->locks[idx + 1], &pattern->locks[idx],
+            (pattern->num_locks - idx) * sizeof(seq_lock_t));
+    pattern->locks[idx] = seq_lock_make(step, param_id, value);
+    ++pattern->num_locks;
+    pattern->locked[step >> 3] |= 1U << (step & 0x7);
+}
+
+static void seq_lock_clear(seq_pattern_t* pattern, uint8_t step) {
+    if (!seq_step_is_locked(pattern, step)) {
+        return;
+    }
+    pattern->locked[step >> 3] &= ~(1U << (step & 0x7));
+    const uint8_t first = seq_lock_find(pattern, step);
+    uint8_t last = first;
+    while (last < pattern->num_locks && seq_lock_step(&pattern->locks[last]) == step) {
+        ++last;
+    }
+    memmove(&pattern->locks[first], &pattern->locks[last],
+            (pattern->num_locks - last) * sizeof(seq_lock_t));
+    pattern->num_locks -= last - first;
+}
+
+// -------------------------------------------------------------------------------------
+
+void seq_engine_init() {
+    s_quantizer.Init();
+    s_quantizer.Configure(scales[2]);
+
+    // one bar on the note track, gates on every other step
+    for (uint8_t p = 0; p < k_seq_num_patterns; ++p) {
+        seq_pattern_t* pattern = &g_seq_patterns[p];
+        pattern->length = k_seq_page_length;
+        for (uint8_t i = 0; i < k_seq_max_length; ++i) {
+            if (!(i & 0x1)) {
+                seq_mask_toggle(pattern->gates, i, 0x1);
+            }
+            seq_value_set(pattern->values[0], i, 0x42);
+            seq_value_set(pattern->values[1], i, 0x40);
+        }
+    }
+}
+
+bool seq_engine_check_pattern(const seq_pattern_t* pattern) {
+    if (pattern->length < 1 || pattern->length > k_seq_max_length ||
+        pattern->num_locks > k_seq_max_locks) {
+        return false;
+    }
+    uint8_t locked[k_seq_max_length / 8] = {0};
+    uint8_t prev_step = 0;
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < pattern->num_locks; ++i) {
+        const uint8_t step = seq_lock_step(&pattern->locks[i]);
+        if (pattern->locks[i].param_id >= k_num_param_id || step < prev_step) {
+            return false;
+        }
+        count = (i && step == prev_step) ? count + 1 : 1;
+        if (count > k_seq_max_step_locks) {
+            return false;
+        }
+        locked[step >> 3] |= 1U << (step & 0x7);
+        prev_step = step;
+    }
+    return memcmp(locked, pattern->locked, sizeof(locked)) == 0;
+}
+
+void seq_engine_hold_edits(bool hold) { s_edits_held = hold; }
+
+void seq_engine_rewind() {
+    // release everything, tied notes included
+    g_seq_tracks.step = 0xFF;
+    seq_engine_gate_off();
+}
+
+static void seq_engine_trigger(const seq_pattern_t* pattern, uint8_t step) {
+    seq_frame_t frame;
+    frame.num_params = 0;
+    frame.num_events = 0;
+
+    // note state as of this step, kept only if the frame is queued. Otherwise the notes
+    // still sounding stay on record and the next gate off releases them.
+    uint8_t notes[k_seq_num_tracks];
+    memcpy(notes, g_seq_tracks.notes, sizeof(notes));
+    uint8_t notes_on = g_seq_tracks.notes_on;
+
+    // only visit tracks gated on this step
+    uint8_t active = seq_mask_get(pattern->gates, step);
+    const uint8_t accents = seq_mask_get(pattern->accents, step);
+    for (uint8_t t = 0; active; ++t, active >>= 1) {
+        if (!(active & 0x1)) {
+            continue;
+        }
+        const uint8_t value = seq_value_get(pattern->values[t], step);
+        if (g_seq_tracks.kind[t] != k_seq_track_kind_note) {
+            // 7 bit step value to 10 bit parameter value
+            seq_frame_param(&frame, g_seq_tracks.param_id[t], value << 3);
+            continue;
+        }
+
+        // quantize note on fly so we can change scales quickly
+        const uint8_t note =
+            pitch_to_note(s_quantizer.Process(note_to_pitch(value), k_pitch_root));
+        const uint8_t bit = 1U << t;
+        const uint8_t prev_note = notes[t];
+        if ((notes_on & bit) && prev_note == note) {
+            // tied into the same note, keep it sounding
+            continue;
+        }
+        seq_frame_event(&frame, k_nts1_tx_event_id_note_on, note,
+                        (accents & bit) ? k_seq_accent_velocity : k_seq_velocity);
+        if (notes_on & bit) {
+            // tied into a new note, release the previous one after the new one started
+            seq_frame_event(&frame, k_nts1_tx_event_id_note_off, prev_note, 0x00);
+        }
+        notes[t] = note;
+        notes_on |= bit;
+    }
+
+    // steps without locks only cost the bit test
+    if (seq_step_is_locked(pattern, step)) {
+        for (uint8_t i = seq_lock_find(pattern, step);
+             i < pattern->num_locks && seq_lock_step(&pattern->locks[i]) == step; ++i) {
+            seq_frame_param(&frame, pattern->locks[i].param_id,
+                            seq_lock_value(&pattern->locks[i]));
+        }
+    }
+
+    if (seq_frame_send(&frame) == NTS1::STATUS_OK) {
+        memcpy(g_seq_tracks.notes, notes, sizeof(notes));
+        g_seq_tracks.notes_on = notes_on;
+    }
+}
+
+uint8_t seq_engine_next_step() {
+    uint8_t step = g_seq_tracks.step + 1;
+    if (step >= g_seq_patterns[g_seq_tracks.pattern].length) {
+        // end of pattern, chain to the next queued one if any
+        step = 0;
+        if (g_seq_tracks.queue_ridx != g_seq_tracks.queue_widx) {
+            g_seq_tracks.pattern =
+                g_seq_tracks.queue[g_seq_tracks.queue_ridx++ & (k_seq_queue_length - 1)];
+        }
+    }
+    seq_engine_trigger(&g_seq_patterns[g_seq_tracks.pattern], step);
+    g_seq_tracks.step = step;
+    return step;
+}
+
+void seq_engine_gate_off() {
+    uint8_t off = g_seq_tracks.notes_on;
+    if (g_seq_tracks.step != 0xFF) {
+        // notes tied into the next step keep sounding
+        off &= ~seq_mask_get(g_seq_patterns[g_seq_tracks.pattern].ties, g_seq_tracks.step);
+    }
+    // a note off that could not be queued stays pending, retried by the next gate off or
+    // sent with the next note on the track
+    for (uint8_t t = 0; off; ++t, off >>= 1) {
+        if ((off & 0x1) && NTS1::noteOff(g_seq_tracks.notes[t]) == NTS1::STATUS_OK) {
+            g_seq_tracks.notes_on &= ~(1U << t);
+        }
+    }
+}
+
+// Steps of a page with the track's bit set in a per step track mask
+static uint32_t page_mask(const uint8_t* masks, uint8_t track, uint8_t page) {
+    uint32_t mask = 0;
+    for (uint8_t i = 0; i < k_seq_page_length; ++i) {
+        mask |= ((seq_mask_get(masks, page * k_seq_page_length + i) >> track) & 0x1) << i;
+    }
+    return mask;
+}
+
+uint32_t seq_engine_page_gates(uint8_t track, uint8_t page) {
+    return page_mask(g_seq_patterns[g_seq_tracks.pattern].gates, track, page);
+}
+
+uint32_t seq_engine_page_accents(uint8_t track, uint8_t page) {
+    return page_mask(g_seq_patterns[g_seq_tracks.pattern].accents, track, page);
+}
+
+void seq_engine_toggle_gates(uint8_t track, uint8_t page, uint32_t steps) {
+    if (s_edits_held) {
+        return;
+    }
+    uint8_t* gates = g_seq_patterns[g_seq_tracks.pattern].gates;
+    for (uint8_t i = 0; i < k_seq_page_length; ++i) {
+        if (steps & (1U << i)) {
+            seq_mask_toggle(gates, page * k_seq_page_length + i, 1U << track);
+        }
+    }
+}
+
+void seq_engine_cycle_articulation(uint8_t track, uint8_t page, uint32_t steps) {
+    if (s_edits_held) {
+        return;
+    }
+    seq_pattern_t* pattern = &g_seq_patterns[g_seq_tracks.pattern];
+    const uint8_t bit = 1U << track;
+    for (uint8_t i = 0; i < k_seq_page_length; ++i) {
+        if (steps & (1U << i)) {
+            // none -> accent -> tie -> accent + tie -> none
+            const uint8_t step = page * k_seq_page_length + i;
+            seq_mask_toggle(pattern->accents, step, bit);
+            if (!(seq_mask_get(pattern->accents, step) & bit)) {
+                seq_mask_toggle(pattern->ties, step, bit);
+            }
+        }
+    }
+}
+
+void seq_engine_set_values(uint8_t track, uint8_t page, uint32_t steps, uint8_t value) {
+    if (s_edits_held) {
+        return;
+    }
+    uint8_t* values = g_seq_patterns[g_seq_tracks.pattern].values[track];
+    for (uint8_t i = 0; i < k_seq_page_length; ++i) {
+        // only effect selected steps
+        if (steps & (1U << i)) {
+            seq_value_set(values, page * k_seq_page_length + i, value);
+        }
+    }
+}
+
+void seq_engine_set_length(uint8_t length) {
+    if (s_edits_held) {
+        return;
+    }
+    if (length < 1 || length > k_seq_max_length) {
+        return;
+    }
+    g_seq_patterns[g_seq_tracks.pattern].length = length;
+}
+
+void seq_engine_queue_pattern(uint8_t pattern) {
+    if (pattern >= k_seq_num_patterns ||
+        (uint8_t)(g_seq_tracks.queue_widx - g_seq_tracks.queue_ridx) >= k_seq_queue_length) {
+        return;
+    }
+    g_seq_tracks.queue[g_seq_tracks.queue_widx++ & (k_seq_queue_length - 1)] = pattern;
+}
+
+void seq_engine_set_locks(uint8_t page, uint32_t steps, uint8_t param_id, uint16_t value) {
+    if (s_edits_held) {
+        return;
+    }
+    seq_pattern_t* pattern = &g_seq_patterns[g_seq_tracks.pattern];
+    for (uint8_t i = 0; i < k_seq_page_length; ++i) {
+        if (steps & (1U << i)) {
+            seq_lock_set(pattern, page * k_seq_page_length + i, param_id, value);
+        }
+    }
+}
+
+void seq_engine_clear_locks(uint8_t page, uint32_t steps) {
+    if (s_edits_held) {
+        return;
+    }
+    seq_pattern_t* pattern = &g_seq_patterns[g_seq_tracks.pattern];
+    for (uint8_t i = 0; i < k_seq_page_length; ++i) {
+        if (steps & (1U << i)) {
+            seq_lock_clear(pattern, page * k_seq_page_length + i);
+        }
+    }
+}
@@ -0,0 +1,33 @@
+// Shared by the native test suites, included as "../bench.h": a timestamp for the
+// benchmarks and a seeded random generator, so failures repeat.
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define k_bench_unit "cycle"  // TSC ticks, reference cycles
+static inline uint64_t bench_now(void) { return __rdtsc(); }
+#else
+#include <time.h>
+#define k_bench_unit "ns"
+static inline uint64_t bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+#define k_rng_seed 0x2545F491U
+
+static inline uint32_t rng_next(uint32_t* state) {
+    // xorshift32
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+#endif  // BENCH_H_
@@ -0,0 +1,14 @@
+#ifndef TEST_CODEC_KERNELS_H_
+#define TEST_CODEC_KERNELS_H_
+
+#include <stdint.h>
+
+// nts1_codec.h built with NTS1_CODEC_SWAR 1 (codec_swar.c) and 0 (codec_words.c)
+
+uint32_t codec_swar_7to8(uint8_t* dest8, const uint8_t* src7, uint32_t size7);
+uint32_t codec_swar_8to7(uint8_t* dest7, const uint8_t* src8, uint32_t size8);
+
+uint32_t codec_words_7to8(uint8_t* dest8, const uint8_t* src7, uint32_t size7);
+uint32_t codec_words_8to7(uint8_t* dest7, const uint8_t* src8, uint32_t size8);
+
+#endif  // TEST_CODEC_KERNELS_H_
@@ -0,0 +1,12 @@
+#define NTS1_CODEC_SWAR 1
+#include <nts1_codec.h>
+
+#include "codec_kernels.h"
+
+uint32_t codec_swar_7to8(uint8_t* dest8, const uint8_t* src7, uint32_t size7) {
+    return nts1_codec_7to8(dest8, src7, size7);
+}
+
+uint32_t codec_swar_8to7(uint8_t* dest7, const uint8_t* src8, uint32_t size8) {
+    return nts1_codec_8to7(dest7, src8, size8);
+}
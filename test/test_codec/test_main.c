@@ -0,0 +1,198 @@
+// 7 bit / 8 bit codec: both block kernel variants against the byte at a time converters
+// they replaced, and their throughput. pio test -e native -f test_codec -v shows the
+// benchmark figures.
+
+#include <nts1_iface.h>
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include "../bench.h"
+#include "codec_kernels.h"
+
+typedef uint32_t (*codec_fn)(uint8_t* dest, const uint8_t* src, uint32_t size);
+
+// -- Reference, nts1_convert_7to8() / nts1_convert_8to7() before block kernels -------
+
+static uint32_t ref_convert_7to8(uint8_t* dest8, const uint8_t* src7, uint32_t size7) {
+    const uint32_t size8 = nts1_size_7to8(size7);
+    for (uint32_t i7 = 0, i8 = 0; i7 < size7; ++i7) {
+        const uint8_t i7mod8 = i7 % 8;
+        switch (i7mod8) {
+            case 0:
+                dest8[i8++] = src7[i7] & 0x7F;
+                break;
+            case 7:
+                dest8[i8 - 1] |= (src7[i7] & 0x7F) << 1;
+                break;
+            default: {
+                const uint8_t offset = 8 - i7mod8;
+                const uint8_t src = src7[i7];
+                dest8[i8 - 1] |= (src & ((1U << i7mod8) - 1)) << offset;
+                dest8[i8++] = (src & 0x7F) >> i7mod8;
+            } break;
+        }
+    }
+    return size8;
+}
+
+static uint32_t ref_convert_8to7(uint8_t* dest7, const uint8_t* src8, uint32_t size8) {
+    const uint32_t size7 = nts1_size_8to7(size8);
+    for (uint32_t i7 = 0, i8 = 0; i7 < size7; ++i7) {
+        const uint8_t i7mod8 = i7 % 8;
+        switch (i7mod8) {
+            case 0:
+                dest7[i7] = src8[i8++] & 0x7F;
+                break;
+            case 7:
+                dest7[i7] = (src8[i8 - 1] & (0x7F << 1)) >> 1;
+                break;
+            default: {
+                const uint8_t offset = 8 - i7mod8;
+                uint8_t dest = (src8[i8 - 1] & (0xFFU << offset)) >> offset;
+                dest |= (src8[i8++] & (0x7F >> i7mod8)) << i7mod8;
+                dest7[i7] = dest;
+            } break;
+        }
+    }
+    return size7;
+}
+
+// -------------------------------------------------------------------------------------
+
+#define k_max_size 300    // bytes converted per case, covers every tail length many times
+#define k_buf_size 512    // room for what the converters write and read past the end
+#define k_rounds 200      // random fills per size
+#define k_bench_size 4096  // input bytes per timed run, converted in as many calls as fit
+#define k_bench_reps 2000
+
+static uint32_t s_rng = k_rng_seed;
+
+static uint8_t rng_byte(void) { return rng_next(&s_rng) >> 24; }
+
+static void fill_random(uint8_t* buf, uint32_t size) {
+    for (uint32_t i = 0; i < size; ++i) {
+        buf[i] = rng_byte();
+    }
+}
+
+void setUp(void) { s_rng = k_rng_seed; }
+
+void tearDown(void) {}
+
+// Same return value and the same bytes written, out of range ones included, for random
+// input of every size. 7 bit input keeps its top bits set at random, they must be ignored.
+static void check_against_ref(codec_fn fn, codec_fn ref) {
+    static uint8_t src[k_buf_size];
+    static uint8_t dest[k_buf_size];
+    static uint8_t dest_ref[k_buf_size];
+    for (uint32_t size = 0; size <= k_max_size; ++size) {
+        for (uint32_t round = 0; round < k_rounds; ++round) {
+            fill_random(src, sizeof(src));
+            const uint8_t fill = rng_byte();
+            memset(dest, fill, sizeof(dest));
+            memset(dest_ref, fill, sizeof(dest_ref));
+            TEST_ASSERT_EQUAL_UINT32(ref(dest_ref, src, size), fn(dest, src, size));
+            TEST_ASSERT_EQUAL_MEMORY(dest_ref, dest, sizeof(dest));
+        }
+    }
+}
+
+void test_swar_7to8_matches_ref(void) { check_against_ref(codec_swar_7to8, ref_convert_7to8); }
+void test_swar_8to7_matches_ref(void) { check_against_ref(codec_swar_8to7, ref_convert_8to7); }
+void test_words_7to8_matches_ref(void) { check_against_ref(codec_words_7to8, ref_convert_7to8); }
+void test_words_8to7_matches_ref(void) { check_against_ref(codec_words_8to7, ref_convert_8to7); }
+
+// Whole groups survive 8 bit -> 7 bit -> 8 bit, and every 7 bit byte has bit 7 clear
+static void check_round_trip(codec_fn to7, codec_fn to8) {
+    static uint8_t src8[k_buf_size];
+    static uint8_t data7[k_buf_size];
+    static uint8_t data8[k_buf_size];
+    for (uint32_t groups = 0; 7 * groups <= k_max_size; ++groups) {
+        for (uint32_t round = 0; round < k_rounds; ++round) {
+            fill_random(src8, sizeof(src8));
+            to7(data7, src8, 7 * groups);
+            for (uint32_t i = 0; i < 8 * groups; ++i) {
+                TEST_ASSERT_EQUAL_UINT8(0, data7[i] & 0x80);
+            }
+            to8(data8, data7, 8 * groups);
+            TEST_ASSERT_EQUAL_MEMORY(src8, data8, 7 * groups);
+        }
+    }
+}
+
+void test_swar_round_trip(void) { check_round_trip(codec_swar_8to7, codec_swar_7to8); }
+void test_words_round_trip(void) { check_round_trip(codec_words_8to7, codec_words_7to8); }
+
+// -- Throughput ----------------------------------------------------------------------
+
+static volatile uint8_t s_sink;
+
+// Best of k_bench_reps runs converting size input bytes per call, k_bench_size bytes a
+// run, input bytes per unit. Small sizes time the per call overhead and the tail handling
+// a message pays, that a single large call hides.
+static double bench(codec_fn fn, uint32_t size) {
+    static uint8_t src[k_bench_size + 8];
+    static uint8_t dest[2 * k_bench_size];
+    const uint32_t calls = k_bench_size / size;
+    fill_random(src, sizeof(src));
+    uint64_t best = ~0ULL;
+    for (uint32_t rep = 0; rep < k_bench_reps; ++rep) {
+        const uint64_t start = bench_now();
+        for (uint32_t call = 0; call < calls; ++call) {
+            fn(dest + 2 * size * call, src + size * call, size);
+        }
+        const uint64_t elapsed = bench_now() - start;
+        s_sink ^= dest[rep % k_bench_size];
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best ? (double)(calls * size) / best : 0.0;
+}
+
+static void report(const char* name, uint32_t size, codec_fn ref, codec_fn swar,
+                   codec_fn words) {
+    char msg[160];
+    const double r = bench(ref, size);
+    const double s = bench(swar, size);
+    const double w = bench(words, size);
+    snprintf(msg, sizeof(msg), "%s %u B, bytes/" k_bench_unit ": ref %.3f, swar %.3f "
+             "(x%.1f), words %.3f (x%.1f)", name, (unsigned)size, r, s, r > 0 ? s / r : 0.0,
+             w, r > 0 ? w / r : 0.0);
+    TEST_MESSAGE(msg);
+}
+
+void test_throughput(void) {
+    report("7to8", k_bench_size, ref_convert_7to8, codec_swar_7to8, codec_words_7to8);
+    report("8to7", k_bench_size, ref_convert_8to7, codec_swar_8to7, codec_words_8to7);
+}
+
+// The payloads the link actually decodes, a unit and an edit param descriptor event as
+// they come in 7 bit, and the same structs encoded back
+void test_throughput_descriptors(void) {
+    const uint32_t unit7 = nts1_size_8to7(sizeof(nts1_rx_unit_desc_t));
+    const uint32_t param7 = nts1_size_8to7(sizeof(nts1_rx_edit_param_desc_t));
+    report("7to8 unit_desc", unit7, ref_convert_7to8, codec_swar_7to8, codec_words_7to8);
+    report("7to8 edit_param_desc", param7, ref_convert_7to8, codec_swar_7to8,
+           codec_words_7to8);
+    report("8to7 unit_desc", sizeof(nts1_rx_unit_desc_t), ref_convert_8to7,
+           codec_swar_8to7, codec_words_8to7);
+    report("8to7 edit_param_desc", sizeof(nts1_rx_edit_param_desc_t), ref_convert_8to7,
+           codec_swar_8to7, codec_words_8to7);
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    UNITY_BEGIN();
+    RUN_TEST(test_swar_7to8_matches_ref);
+    RUN_TEST(test_swar_8to7_matches_ref);
+    RUN_TEST(test_words_7to8_matches_ref);
+    RUN_TEST(test_words_8to7_matches_ref);
+    RUN_TEST(test_swar_round_trip);
+    RUN_TEST(test_words_round_trip);
+    RUN_TEST(test_throughput);
+    RUN_TEST(test_throughput_descriptors);
+    return UNITY_END();
+}
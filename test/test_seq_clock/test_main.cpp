@@ -0,0 +1,171 @@
+// Sequencer clock (include/seq_clock.h) over hours of simulated time: exact against
+// the ideal schedule at constant tempo, no accumulated drift through random tempo
+// changes and no phase jump at a change. The schemes it replaced run on the same tempo
+// schedules for comparison, pio test -e native -f test_seq_clock -v shows their drift.
+
+#include <seq_clock.h>
+#include <stdio.h>
+#include <unity.h>
+
+#include "../bench.h"
+
+#define k_event_ticks (k_seq_timer_hz * 75ULL)  // timer ticks per event x tempo
+#define k_poll_den (k_seq_poll_hz * 3 / 2)      // polls per tick x tempo
+#define k_poll_us (1000000 / k_seq_poll_hz)
+#define k_tempo_min 40  // 4.0 - 260.0 BPM, the range of the tempo pot
+#define k_tempo_max 2600
+
+static uint32_t s_rng;
+
+static uint32_t rng_tempo() {
+    return k_tempo_min + rng_next(&s_rng) % (k_tempo_max - k_tempo_min + 1);
+}
+
+void setUp(void) { s_rng = k_rng_seed; }
+
+void tearDown(void) {}
+
+static void report(const char* what, double value) {
+    char msg[128];
+    snprintf(msg, sizeof(msg), "%s %.6f", what, value);
+    TEST_MESSAGE(msg);
+}
+
+// -- Constant tempo ------------------------------------------------------------------
+
+// Event n is due at exactly n x k_event_ticks / tempo timer ticks, for 8 hours
+void test_event_constant_tempo_exact(void) {
+    static const uint32_t tempos[] = {k_tempo_min, 1200, 1205, 1337, k_tempo_max};
+    for (uint32_t tempo : tempos) {
+        const seq_clock_rate_t rate = seq_clock_event_rate(tempo);
+        seq_clock_t clock = {0, 0};
+        const uint64_t events = 8ULL * 3600 * k_seq_timer_hz * tempo / k_event_ticks;
+        for (uint64_t n = 1; n <= events; ++n) {
+            seq_clock_advance(&clock, &rate);
+            const uint64_t exact = n * k_event_ticks;
+            TEST_ASSERT_EQUAL_UINT32((uint32_t)(exact / tempo), clock.count);
+            TEST_ASSERT_EQUAL_UINT32(exact % tempo, clock.rem);
+        }
+    }
+}
+
+// After n polls exactly n x tempo / k_poll_den ticks have been counted, for 1 hour
+void test_poll_constant_tempo_exact(void) {
+    static const uint32_t tempos[] = {1205, k_tempo_max};
+    for (uint32_t tempo : tempos) {
+        const seq_clock_rate_t rate = seq_clock_poll_rate(tempo);
+        seq_clock_t clock = {0, 0};
+        uint64_t ticks = 0;
+        for (uint64_t n = 1; n <= 3600ULL * k_seq_poll_hz; ++n) {
+            ticks += seq_clock_advance(&clock, &rate);
+            if ((n & 0xFFF) == 0) {
+                TEST_ASSERT_EQUAL_UINT32(n * tempo / k_poll_den, ticks);
+                TEST_ASSERT_EQUAL_UINT32(n * tempo % k_poll_den, clock.rem);
+            }
+        }
+    }
+}
+
+// -- Tempo changes -------------------------------------------------------------------
+
+// Event mode for 8 hours with the tempo changed every 0.1 - 10 s. The ideal schedule
+// puts each event k_event_ticks / tempo after the previous one, tempo being the one in
+// effect when the previous event fired, as in seq_interrupt_handler().
+void test_event_tempo_changes(void) {
+    uint32_t tempo = 1200;
+    seq_clock_rate_t rate = seq_clock_event_rate(tempo);
+    seq_clock_t clock = {0, 0};
+    long double ideal = 0;     // timer ticks
+    uint64_t accum_16_16 = 0;  // the 16.16 phase accumulator this replaced
+    uint32_t inc_16_16 = (k_event_ticks << 16) / tempo;
+    double max_drift = 0, max_drift_16_16 = 0, max_jump = 0;
+    uint32_t changes = 0;
+
+    const uint64_t end = 8ULL * 3600 * k_seq_timer_hz;
+    uint64_t next_change = 0;
+    while (clock.count < end) {
+        if (clock.count >= next_change) {
+            // a tempo change between two events keeps the position
+            const double before = clock.count + (double)clock.rem / rate.den;
+            tempo = rng_tempo();
+            const seq_clock_rate_t new_rate = seq_clock_event_rate(tempo);
+            seq_clock_set_rate(&clock, &rate, &new_rate);
+            const double after = clock.count + (double)clock.rem / rate.den;
+            const double jump = after > before ? after - before : before - after;
+            // less than one unit of the new remainder
+            TEST_ASSERT_TRUE(jump < 1.0 / rate.den);
+            max_jump = jump > max_jump ? jump : max_jump;
+            inc_16_16 = (k_event_ticks << 16) / tempo;
+            next_change = clock.count + k_seq_timer_hz / 10 + rng_next(&s_rng) % (10 * k_seq_timer_hz);
+            ++changes;
+        }
+        seq_clock_advance(&clock, &rate);
+        ideal += (long double)k_event_ticks / tempo;
+        accum_16_16 += inc_16_16;
+
+        const double drift = (double)(clock.count + (long double)clock.rem / rate.den - ideal);
+        const double drift_16_16 = (double)(accum_16_16 / 65536.0L - ideal);
+        TEST_ASSERT_TRUE(drift < 0.5 && drift > -0.5);
+        const double abs_drift = drift < 0 ? -drift : drift;
+        max_drift = abs_drift > max_drift ? abs_drift : max_drift;
+        max_drift_16_16 = -drift_16_16 > max_drift_16_16 ? -drift_16_16 : max_drift_16_16;
+    }
+    TEST_ASSERT_TRUE(changes > 5000);
+    report("max drift, timer ticks:", max_drift);
+    report("max phase jump at a tempo change, timer ticks:", max_jump);
+    report("16.16 accumulator max drift, timer ticks:", max_drift_16_16);
+}
+
+// Poll mode for 2 hours with the tempo changed every 0.1 - 10 s. The ideal tick count
+// is the sum of tempo / k_poll_den over the polls, kept exact as a numerator. The
+// last_tick_us carry-over this replaced runs alongside on the same micros().
+void test_poll_tempo_changes(void) {
+    uint32_t tempo = 1200;
+    seq_clock_rate_t rate = seq_clock_poll_rate(tempo);
+    seq_clock_t clock = {0, 0};
+    uint64_t ideal_num = 0;  // ideal ticks x k_poll_den
+    uint64_t ticks = 0;
+    uint64_t old_ticks = 0;
+    uint32_t last_tick_us = 0;
+    int64_t max_old_drift = 0;
+
+    const uint64_t polls = 2ULL * 3600 * k_seq_poll_hz;
+    uint64_t next_change = 0;
+    for (uint64_t n = 1; n <= polls; ++n) {
+        if (n >= next_change) {
+            tempo = rng_tempo();
+            const seq_clock_rate_t new_rate = seq_clock_poll_rate(tempo);
+            seq_clock_set_rate(&clock, &rate, &new_rate);
+            next_change = n + k_seq_poll_hz / 10 + rng_next(&s_rng) % (10 * k_seq_poll_hz);
+        }
+        ideal_num += tempo;
+        ticks += seq_clock_advance(&clock, &rate);
+        // phase continuity and no drift in one: the clock is the ideal, exactly
+        TEST_ASSERT_EQUAL_UINT32(ideal_num / k_poll_den, ticks);
+        TEST_ASSERT_EQUAL_UINT32(ideal_num % k_poll_den, clock.rem);
+
+        const uint32_t now_us = (uint32_t)(n * k_poll_us);
+        const uint32_t us_per_tick = 600000000UL / (4 * tempo * 100);
+        const uint32_t tick_delta_us = now_us - last_tick_us;
+        if (tick_delta_us >= us_per_tick) {
+            ++old_ticks;
+            last_tick_us = now_us - (tick_delta_us - us_per_tick);
+        }
+        const int64_t old_drift = (int64_t)old_ticks - (int64_t)(ideal_num / k_poll_den);
+        max_old_drift = old_drift > max_old_drift ? old_drift : max_old_drift;
+    }
+    report("last_tick_us carry-over max drift, ticks:", (double)max_old_drift);
+    report("last_tick_us carry-over drift after 2 h, ticks:",
+           (double)((int64_t)old_ticks - (int64_t)(ideal_num / k_poll_den)));
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    UNITY_BEGIN();
+    RUN_TEST(test_event_constant_tempo_exact);
+    RUN_TEST(test_poll_constant_tempo_exact);
+    RUN_TEST(test_event_tempo_changes);
+    RUN_TEST(test_poll_tempo_changes);
+    return UNITY_END();
+}
@@ -0,0 +1,116 @@
+// Sequencer pitch conversion (include/seq_pitch.h): round trip, rounding and clamping,
+// and the worst case cost of the conversions for one step against the libm conversion
+// they replaced.
+// pio test -e native -f test_seq_pitch -v shows the benchmark figures. The host has an
+// FPU, on the STM32F030 the double pow() / log2() run in soft-float and cost far more.
+
+#include <math.h>
+#include <seq_pitch.h>
+#include <stdio.h>
+#include <unity.h>
+
+#include "../bench.h"
+
+#define k_bench_chain 256  // dependent conversions per measurement
+#define k_bench_reps 200
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+// -- Reference, note_to_pitch() / pitch_to_note() before seq_pitch.h -----------------
+
+static int32_t ref_note_to_pitch(uint8_t note) {
+    return 440.0 * pow(2.0, ((double)note - 69) / 12.0);
+}
+
+static uint8_t ref_pitch_to_note(int32_t pitch) {
+    // clamped here, the original converted a negative double for the lowest notes
+    const double note = 12 * log2((double)pitch / 440.0) + 69;
+    return (note > 0) ? (uint8_t)note : 0;
+}
+
+// -- Conversion -----------------------------------------------------------------------
+
+void test_round_trip(void) {
+    for (uint16_t n = 0; n < 128; ++n) {
+        TEST_ASSERT_EQUAL_INT32((int32_t)n * 128, note_to_pitch(n));
+        TEST_ASSERT_EQUAL_UINT8(n, pitch_to_note(note_to_pitch(n)));
+    }
+    // only the 7 bit MIDI range is looked at
+    TEST_ASSERT_EQUAL_INT32(note_to_pitch(0x05), note_to_pitch(0x85));
+}
+
+void test_rounds_to_nearest(void) {
+    for (uint16_t n = 1; n < 127; ++n) {
+        const int32_t pitch = note_to_pitch(n);
+        TEST_ASSERT_EQUAL_UINT8(n, pitch_to_note(pitch + 63));
+        TEST_ASSERT_EQUAL_UINT8(n + 1, pitch_to_note(pitch + 64));
+        TEST_ASSERT_EQUAL_UINT8(n, pitch_to_note(pitch - 64));
+        TEST_ASSERT_EQUAL_UINT8(n - 1, pitch_to_note(pitch - 65));
+    }
+}
+
+void test_clamps(void) {
+    TEST_ASSERT_EQUAL_UINT8(0, pitch_to_note(-1));
+    TEST_ASSERT_EQUAL_UINT8(0, pitch_to_note(INT32_MIN));
+    TEST_ASSERT_EQUAL_UINT8(127, pitch_to_note(note_to_pitch(127) + 64));
+    TEST_ASSERT_EQUAL_UINT8(127, pitch_to_note(INT32_MAX));
+}
+
+// -- Benchmark ------------------------------------------------------------------------
+
+static volatile uint32_t s_sink;
+
+// Best of k_bench_reps chains of pitch_to_note(note_to_pitch()) from note, units per step.
+// Each conversion takes the last result as input so the chain measures latency, what a
+// sequencer step waits for.
+template <int32_t (*to_pitch)(uint8_t), uint8_t (*to_note)(int32_t)>
+static double bench_step(uint8_t note) {
+    uint64_t best = UINT64_MAX;
+    for (uint32_t rep = 0; rep < k_bench_reps; ++rep) {
+        uint32_t acc = 0;
+        const uint64_t start = bench_now();
+        for (uint32_t i = 0; i < k_bench_chain; ++i) {
+            // acc >> 24 stays 0, the compiler cannot tell
+            acc += to_note(to_pitch(note | (uint8_t)(acc >> 24)));
+        }
+        const uint64_t elapsed = bench_now() - start;
+        s_sink ^= acc;
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return (double)best / k_bench_chain;
+}
+
+static int32_t new_note_to_pitch(uint8_t note) { return note_to_pitch(note); }
+static uint8_t new_pitch_to_note(int32_t pitch) { return pitch_to_note(pitch); }
+
+// Worst case over every note, pow() and log2() are not constant time
+void test_benchmark(void) {
+    double ref_worst = 0.0;
+    double new_worst = 0.0;
+    for (uint16_t n = 0; n < 128; ++n) {
+        const double r = bench_step<ref_note_to_pitch, ref_pitch_to_note>(n);
+        const double s = bench_step<new_note_to_pitch, new_pitch_to_note>(n);
+        ref_worst = (r > ref_worst) ? r : ref_worst;
+        new_worst = (s > new_worst) ? s : new_worst;
+    }
+    char msg[128];
+    snprintf(msg, sizeof(msg), "worst " k_bench_unit "/step: libm %.1f, shift %.1f (x%.0f)",
+             ref_worst, new_worst, new_worst > 0 ? ref_worst / new_worst : 0.0);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_TRUE(new_worst < ref_worst);
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    UNITY_BEGIN();
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_rounds_to_nearest);
+    RUN_TEST(test_clamps);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,276 @@
+// SPSC_RING_DEFINE: full and empty edges, wraparound of the free running indices, a
+// producer and a consumer thread hammering one ring, and cycles per byte against the
+// SPI_BUF_INC buffer it replaced. pio test -e native -f test_spsc_ring -v shows the
+// benchmark figures.
+
+#include <pthread.h>
+#include <sched.h>
+#include <spsc_ring.h>
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include "../bench.h"
+
+#define k_ring_size 512  // as SPI_TX_BUF_SIZE
+SPSC_RING_DEFINE(byte_ring, uint8_t, k_ring_size)
+SPSC_RING_DEFINE(word_ring, uint32_t, 4)
+
+#define k_index_wrap 0x10000  // the indices are uint16_t
+
+static byte_ring_t s_ring;
+
+static uint32_t s_rng;
+
+void setUp(void) {
+    byte_ring_reset(&s_ring);
+    s_rng = k_rng_seed;
+}
+
+void tearDown(void) {}
+
+// -- Edges ---------------------------------------------------------------------------
+
+static void check_edges(uint16_t start) {
+    word_ring_t r;
+    r.widx = start;
+    r.ridx = start;
+    TEST_ASSERT_EQUAL_UINT16(0, word_ring_count(&r));
+    TEST_ASSERT_EQUAL_UINT16(4, word_ring_space(&r));
+
+    // fill to the last slot, full is count == size with no slot given up
+    for (uint32_t i = 0; i < 4; ++i) {
+        word_ring_put(&r, 100 + i);
+        TEST_ASSERT_EQUAL_UINT16(i + 1, word_ring_count(&r));
+        TEST_ASSERT_EQUAL_UINT16(3 - i, word_ring_space(&r));
+    }
+    TEST_ASSERT_EQUAL_UINT16((uint16_t)(start + 4), r.widx);
+
+    // drain back to empty, in order
+    for (uint32_t i = 0; i < 4; ++i) {
+        TEST_ASSERT_EQUAL_UINT32(100 + i, word_ring_get(&r));
+        TEST_ASSERT_EQUAL_UINT16(3 - i, word_ring_count(&r));
+    }
+    TEST_ASSERT_EQUAL_UINT16(r.widx, r.ridx);
+    TEST_ASSERT_EQUAL_UINT16(4, word_ring_space(&r));
+}
+
+void test_empty_and_full(void) { check_edges(0); }
+
+// Full and empty look the same as ever with the indices on either side of the wrap
+void test_edges_across_index_wrap(void) {
+    for (uint32_t start = k_index_wrap - 8; start < k_index_wrap + 8; ++start) {
+        check_edges((uint16_t)start);
+    }
+}
+
+// Poked slots stay invisible until the commit, peeked ones stay owned until consumed
+void test_poke_commit_peek_consume(void) {
+    s_ring.widx = s_ring.ridx = k_index_wrap - 3;
+    for (uint16_t i = 0; i < 7; ++i) {
+        byte_ring_poke(&s_ring, i, 0x40 + i);
+    }
+    TEST_ASSERT_EQUAL_UINT16(0, byte_ring_count(&s_ring));
+    byte_ring_commit(&s_ring, 7);
+    TEST_ASSERT_EQUAL_UINT16(7, byte_ring_count(&s_ring));
+    for (uint16_t i = 0; i < 7; ++i) {
+        TEST_ASSERT_EQUAL_UINT8(0x40 + i, byte_ring_peek(&s_ring, i));
+    }
+    TEST_ASSERT_EQUAL_UINT16(7, byte_ring_count(&s_ring));
+    byte_ring_consume(&s_ring, 7);
+    TEST_ASSERT_EQUAL_UINT16(0, byte_ring_count(&s_ring));
+    TEST_ASSERT_EQUAL_UINT16(4, s_ring.ridx);
+}
+
+// Random fill levels through several wraps of both indices, checked against a model
+void test_wraparound(void) {
+    uint32_t written = 0, read = 0;  // model of the free running indices, never wrap
+    s_ring.widx = s_ring.ridx = k_index_wrap - k_ring_size / 2;
+    const uint32_t base = s_ring.widx;
+    while (read < 4 * k_index_wrap) {
+        const uint16_t n_put = rng_next(&s_rng) % (k_ring_size / 4);
+        for (uint16_t i = 0; i < n_put && byte_ring_space(&s_ring); ++i) {
+            byte_ring_put(&s_ring, (uint8_t)(written++ * 7));
+        }
+        TEST_ASSERT_EQUAL_UINT16(written - read, byte_ring_count(&s_ring));
+        TEST_ASSERT_EQUAL_UINT16((uint16_t)(base + written), s_ring.widx);
+        TEST_ASSERT_LESS_OR_EQUAL(k_ring_size, byte_ring_count(&s_ring));
+
+        const uint16_t n_get = rng_next(&s_rng) % (k_ring_size / 4);
+        for (uint16_t i = 0; i < n_get && byte_ring_count(&s_ring); ++i) {
+            TEST_ASSERT_EQUAL_UINT8((uint8_t)(read++ * 7), byte_ring_get(&s_ring));
+        }
+        TEST_ASSERT_EQUAL_UINT16(k_ring_size - (written - read), byte_ring_space(&s_ring));
+    }
+}
+
+// -- Two threads ---------------------------------------------------------------------
+
+#define k_stress_bytes 20000000U
+
+static volatile uint32_t s_max_count;  // producer side view, never above the size
+static volatile uint32_t s_errors;
+
+// Commands of 1 - 7 bytes as the tx path writes them, a running sequence number per byte
+static void* stress_producer(void* arg) {
+    (void)arg;
+    uint32_t rng = 0x1234567;
+    uint32_t seq = 0;
+    while (seq < k_stress_bytes) {
+        uint16_t n = 1 + rng_next(&rng) % 7;
+        if (n > k_stress_bytes - seq) {
+            n = k_stress_bytes - seq;
+        }
+        const uint16_t space = byte_ring_space(&s_ring);
+        if (space > k_ring_size) {
+            ++s_errors;
+        }
+        if ((uint32_t)(k_ring_size - space) > s_max_count) {
+            s_max_count = k_ring_size - space;
+        }
+        if (space < n) {
+            sched_yield();  // the host may only have the one core
+            continue;
+        }
+        for (uint16_t i = 0; i < n; ++i) {
+            byte_ring_poke(&s_ring, i, (uint8_t)(seq + i));
+        }
+        byte_ring_commit(&s_ring, n);
+        seq += n;
+    }
+    return NULL;
+}
+
+void test_threads_no_loss_or_reordering(void) {
+    // indices start just short of the wrap, they wrap about 300 times during the run
+    s_ring.widx = s_ring.ridx = k_index_wrap - 5;
+    s_max_count = 0;
+    s_errors = 0;
+
+    pthread_t producer;
+    TEST_ASSERT_EQUAL_INT(0, pthread_create(&producer, NULL, stress_producer, NULL));
+
+    uint32_t rng = 0x7654321;
+    uint32_t seq = 0;
+    uint32_t mismatches = 0;
+    while (seq < k_stress_bytes) {
+        const uint16_t count = byte_ring_count(&s_ring);
+        if (count > k_ring_size) {
+            ++s_errors;
+        }
+        if (!count) {
+            sched_yield();
+            continue;
+        }
+        // the consumer takes what it likes of what is there, as the rx parser does
+        const uint16_t n = 1 + rng_next(&rng) % count;
+        for (uint16_t i = 0; i < n; ++i) {
+            mismatches += byte_ring_peek(&s_ring, i) != (uint8_t)(seq + i);
+        }
+        byte_ring_consume(&s_ring, n);
+        seq += n;
+    }
+    pthread_join(producer, NULL);
+
+    TEST_ASSERT_EQUAL_UINT32(0, mismatches);
+    TEST_ASSERT_EQUAL_UINT32(0, s_errors);
+    TEST_ASSERT_EQUAL_UINT16(0, byte_ring_count(&s_ring));
+    TEST_ASSERT_EQUAL_UINT16((uint16_t)(k_index_wrap - 5 + k_stress_bytes), s_ring.ridx);
+    // the ring really was filled to the edge on the way
+    TEST_ASSERT_GREATER_OR_EQUAL(k_ring_size - 6, s_max_count);
+}
+
+// -- Cycles per byte -----------------------------------------------------------------
+
+// The rx buffer before spsc_ring.h: count from a compare, wrap with a compare per byte
+#define SPI_BUF_INC(idx, bufSize) (((idx + 1) == bufSize) ? 0 : idx + 1)
+#define SPI_RX_BUF_MASK (k_ring_size - 1)
+static volatile uint8_t s_ref_buf[k_ring_size];
+static volatile uint16_t s_ref_widx, s_ref_ridx;
+
+static uint8_t ref_buf_write(uint8_t data) {
+    uint16_t bufdatacount;
+    if (s_ref_ridx <= s_ref_widx) {
+        bufdatacount = s_ref_widx - s_ref_ridx;
+    } else {
+        bufdatacount = k_ring_size + s_ref_widx - s_ref_ridx;
+    }
+    if (bufdatacount < (k_ring_size - 2)) {
+        s_ref_buf[SPI_RX_BUF_MASK & s_ref_widx] = data;
+        s_ref_widx = SPI_BUF_INC(s_ref_widx, k_ring_size);
+        return 1;
+    }
+    return 0;
+}
+
+static uint8_t ref_buf_read(void) {
+    const uint8_t data = s_ref_buf[SPI_RX_BUF_MASK & s_ref_ridx];
+    s_ref_ridx = SPI_BUF_INC(s_ref_ridx, k_ring_size);
+    return data;
+}
+
+#define k_bench_bytes 256  // per run, half the ring
+#define k_bench_reps 20000
+
+static volatile uint8_t s_sink;
+
+// Best run of k_bench_bytes writes with the full check, then as many reads
+static double bench_ref(void) {
+    uint64_t best = ~0ULL;
+    for (uint32_t rep = 0; rep < k_bench_reps; ++rep) {
+        uint8_t sum = 0;
+        const uint64_t start = bench_now();
+        for (uint32_t i = 0; i < k_bench_bytes; ++i) {
+            ref_buf_write((uint8_t)i);
+        }
+        for (uint32_t i = 0; i < k_bench_bytes; ++i) {
+            sum += ref_buf_read();
+        }
+        const uint64_t elapsed = bench_now() - start;
+        s_sink = sum;
+        best = elapsed < best ? elapsed : best;
+    }
+    return (double)best / k_bench_bytes;
+}
+
+static double bench_ring(void) {
+    uint64_t best = ~0ULL;
+    for (uint32_t rep = 0; rep < k_bench_reps; ++rep) {
+        uint8_t sum = 0;
+        const uint64_t start = bench_now();
+        for (uint32_t i = 0; i < k_bench_bytes; ++i) {
+            if (byte_ring_space(&s_ring)) {
+                byte_ring_put(&s_ring, (uint8_t)i);
+            }
+        }
+        for (uint32_t i = 0; i < k_bench_bytes; ++i) {
+            sum += byte_ring_get(&s_ring);
+        }
+        const uint64_t elapsed = bench_now() - start;
+        s_sink = sum;
+        best = elapsed < best ? elapsed : best;
+    }
+    return (double)best / k_bench_bytes;
+}
+
+void test_cycles_per_byte(void) {
+    char msg[128];
+    const double ref = bench_ref();
+    const double ring = bench_ring();
+    snprintf(msg, sizeof(msg), "write + read, " k_bench_unit "/byte: SPI_BUF_INC %.2f, "
+             "spsc_ring %.2f", ref, ring);
+    TEST_MESSAGE(msg);
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_and_full);
+    RUN_TEST(test_edges_across_index_wrap);
+    RUN_TEST(test_poke_commit_peek_consume);
+    RUN_TEST(test_wraparound);
+    RUN_TEST(test_threads_no_loss_or_reordering);
+    RUN_TEST(test_cycles_per_byte);
+    return UNITY_END();
+}